@@ -0,0 +1,23 @@
+# SPDX-License-Identifier: Apache-2.0
+
+# Generate ppg_filter_coeffs.h from ppg_filters.yaml for 'target', see
+# ppg_filter_gen.py. Used by the application and by the tests that build
+# src/ppg_filter.h.
+set(PPG_FILTER_DSP_DIR ${CMAKE_CURRENT_LIST_DIR})
+
+function(ppg_filter_coeffs target)
+  set(specs ${PPG_FILTER_DSP_DIR}/ppg_filters.yaml)
+  set(generator ${PPG_FILTER_DSP_DIR}/ppg_filter_gen.py)
+  set(out_dir ${CMAKE_CURRENT_BINARY_DIR}/ppg_filter)
+  set(header ${out_dir}/ppg_filter_coeffs.h)
+
+  file(MAKE_DIRECTORY ${out_dir})
+  add_custom_command(
+    OUTPUT ${header}
+    COMMAND ${PYTHON_EXECUTABLE} ${generator} ${specs} ${header}
+    DEPENDS ${specs} ${generator}
+  )
+  add_custom_target(${target}_ppg_filter_coeffs DEPENDS ${header})
+  add_dependencies(${target} ${target}_ppg_filter_coeffs)
+  target_include_directories(${target} PRIVATE ${out_dir})
+endfunction()
@@ -0,0 +1,357 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+
+"""Turn the PPG filter specs into CMSIS-DSP biquad coefficient tables.
+
+Does at build time what the design_iir_*_cmsis_butter.m scripts do by hand:
+a Butterworth prototype, transformed to the requested band, mapped to z with
+the bilinear transform (corners prewarped) and split into second order
+sections. Each section is scaled to unity gain in the passband so the signal
+keeps its level from one section to the next, which the fixed point
+pipelines rely on. The output is C, usable from C and C++:
+
+    <NAME>_IIR_NUMSTAGES       biquads in the cascade
+    <NAME>_IIR_TABLES          number of sample rates
+    <NAME>_IIR_FIXED_POINT_SAFE
+                               1 when the Q31/Q15 pipelines can't overflow
+    <name>_iir_rates[]         sample rate of each table, Hz
+    <name>_iir_postshift[]     of the q31 and q15 coefficients
+    <name>_iir_coeffs[][]      b0, b1, b2, -a1, -a2 per stage, float
+    <name>_iir_coeffs_q31[][]  same in Q(31 - postshift)
+    <name>_iir_coeffs_q15[][]  b0, 0, b1, b2, -a1, -a2 in Q(15 - postshift)
+
+Only the Python standard library and PyYAML, which Zephyr requires anyway.
+"""
+
+import argparse
+import cmath
+import math
+
+import yaml
+
+TYPES = ("lowpass", "highpass", "bandpass", "bandstop")
+
+# The Q31/Q15 pipelines feed the ADC counts in at half of full scale
+FIXED_POINT_GAIN_MAX = 2.0
+
+
+def butter_prototype(order):
+    """Analog lowpass prototype, 1 rad/s corner: zeros, poles, gain."""
+    poles = [cmath.exp(1j * math.pi * (2 * k + order + 1) / (2 * order))
+             for k in range(order)]
+    return [], poles, 1.0
+
+
+def prod(values):
+    result = 1
+    for v in values:
+        result *= v
+    return result
+
+
+def lp2lp(z, p, k, wo):
+    degree = len(p) - len(z)
+    return [wo * x for x in z], [wo * x for x in p], k * wo ** degree
+
+
+def lp2hp(z, p, k, wo):
+    degree = len(p) - len(z)
+    k *= (prod(-x for x in z) / prod(-x for x in p)).real
+    return [wo / x for x in z] + [0j] * degree, [wo / x for x in p], k
+
+
+def lp2bp(z, p, k, wo, bw):
+    degree = len(p) - len(z)
+
+    def split(roots):
+        out = []
+        for r in roots:
+            r = r * bw / 2
+            s = cmath.sqrt(r * r - wo * wo)
+            out += [r + s, r - s]
+        return out
+
+    return split(z) + [0j] * degree, split(p), k * bw ** degree
+
+
+def lp2bs(z, p, k, wo, bw):
+    degree = len(p) - len(z)
+    k *= (prod(-x for x in z) / prod(-x for x in p)).real
+
+    def split(roots):
+        out = []
+        for r in roots:
+            r = (bw / 2) / r
+            s = cmath.sqrt(r * r - wo * wo)
+            out += [r + s, r - s]
+        return out
+
+    notch = [1j * wo, -1j * wo] * degree
+    return split(z) + notch, split(p), k
+
+
+def bilinear(z, p, k, fs):
+    fs2 = 2 * fs
+    degree = len(p) - len(z)
+    k *= (prod(fs2 - x for x in z) / prod(fs2 - x for x in p)).real
+    zd = [(fs2 + x) / (fs2 - x) for x in z] + [-1 + 0j] * degree
+    pd = [(fs2 + x) / (fs2 - x) for x in p]
+    return zd, pd, k
+
+
+def design(spec, fs):
+    """Digital zeros, poles and gain of a spec at sample rate fs."""
+    kind = spec["type"]
+    order = spec["order"]
+    corners = spec["corners"]
+    warped = [2 * fs * math.tan(math.pi * f / fs) for f in corners]
+
+    if kind in ("lowpass", "highpass"):
+        z, p, k = butter_prototype(order)
+        if kind == "lowpass":
+            z, p, k = lp2lp(z, p, k, warped[0])
+        else:
+            z, p, k = lp2hp(z, p, k, warped[0])
+    else:
+        z, p, k = butter_prototype(order // 2)
+        wo = math.sqrt(warped[0] * warped[1])
+        bw = warped[1] - warped[0]
+        if kind == "bandpass":
+            z, p, k = lp2bp(z, p, k, wo, bw)
+        else:
+            z, p, k = lp2bs(z, p, k, wo, bw)
+
+    return bilinear(z, p, k, fs)
+
+
+def group(roots):
+    """Split roots into conjugate pairs and pairs of reals, a lone real last."""
+    eps = 1e-9
+    pairs = [(r, r.conjugate()) for r in roots if r.imag > eps]
+    reals = sorted(r.real for r in roots if abs(r.imag) <= eps)
+    # Outermost reals together: {-1, 1} for a bandpass section
+    while len(reals) >= 2:
+        pairs.append((complex(reals.pop(0)), complex(reals.pop())))
+    if reals:
+        pairs.append((complex(reals[0]),))
+    return pairs
+
+
+def section(zeros, poles, gain):
+    b = [1.0, 0.0, 0.0]
+    a = [1.0, 0.0, 0.0]
+    if len(zeros) == 2:
+        b = [1.0, -(zeros[0] + zeros[1]).real, (zeros[0] * zeros[1]).real]
+    elif len(zeros) == 1:
+        b = [1.0, -zeros[0].real, 0.0]
+    if len(poles) == 2:
+        a = [1.0, -(poles[0] + poles[1]).real, (poles[0] * poles[1]).real]
+    elif len(poles) == 1:
+        a = [1.0, -poles[0].real, 0.0]
+    return [gain * x for x in b], a
+
+
+def response(b, a, w):
+    e = cmath.exp(-1j * w)
+    return ((b[0] + b[1] * e + b[2] * e * e) /
+            (a[0] + a[1] * e + a[2] * e * e))
+
+
+def passband(spec, fs):
+    """Angular frequency each section is scaled to unity gain at."""
+    kind = spec["type"]
+    if kind in ("lowpass", "bandstop"):
+        return 0.0
+    if kind == "highpass":
+        return math.pi
+    f = math.sqrt(spec["corners"][0] * spec["corners"][1])
+    return 2 * math.pi * f / fs
+
+
+def to_sos(spec, fs):
+    """Second order sections (b, a), least resonant first."""
+    z, p, k = design(spec, fs)
+    pole_groups = group(p)
+    zero_groups = group(z)
+
+    if len(zero_groups) != len(pole_groups):
+        raise ValueError("zeros and poles don't pair up")
+
+    # Most resonant poles take their nearest zeros first
+    pole_groups.sort(key=lambda g: -max(abs(x) for x in g))
+    sections = []
+    for poles in pole_groups:
+        best = min(zero_groups, key=lambda g: abs(g[0] - poles[0]))
+        zero_groups.remove(best)
+        sections.append((best, poles))
+    sections.reverse()
+
+    w = passband(spec, fs)
+    sos = []
+    for zeros, poles in sections:
+        b, a = section(zeros, poles, 1.0)
+        sos.append(section(zeros, poles, 1.0 / abs(response(b, a, w))))
+
+    # What is left of the overall gain, 1 for Butterworth, on the last one
+    e = cmath.exp(-1j * w)
+    total = k * prod(1 - x * e for x in z) / prod(1 - x * e for x in p)
+    cascade = prod(response(b, a, w) for b, a in sos)
+    b, a = sos[-1]
+    sos[-1] = ([x * abs(total) / abs(cascade) for x in b], a)
+
+    return sos
+
+
+def l1_gains(sos, length=4096):
+    """Sum of |h[n]| at the output of each section of the cascade."""
+    signal = [1.0] + [0.0] * (length - 1)
+    gains = []
+    for b, a in sos:
+        out = []
+        x1 = x2 = y1 = y2 = 0.0
+        for x in signal:
+            y = b[0] * x + b[1] * x1 + b[2] * x2 - a[1] * y1 - a[2] * y2
+            x2, x1, y2, y1 = x1, x, y1, y
+            out.append(y)
+        signal = out
+        gains.append(sum(abs(v) for v in signal))
+    return gains
+
+
+def cmsis(sos):
+    """b0, b1, b2, -a1, -a2 per stage."""
+    coeffs = []
+    for b, a in sos:
+        coeffs += [b[0], b[1], b[2], -a[1], -a[2]]
+    return coeffs
+
+
+def quantize(c, frac_bits, word_bits):
+    """c with frac_bits fraction bits, saturated to a signed word."""
+    limit = 1 << (word_bits - 1)
+    return max(-limit, min(limit - 1, round(c * (1 << frac_bits))))
+
+
+def check(spec):
+    name = spec.get("name", "")
+    if not name.isidentifier():
+        raise ValueError(f"bad filter name '{name}'")
+    if spec.get("type") not in TYPES:
+        raise ValueError(f"{name}: type must be one of {', '.join(TYPES)}")
+    order = spec.get("order", 0)
+    corners = spec.get("corners", [])
+    if spec["type"] in ("lowpass", "highpass"):
+        if len(corners) != 1 or order < 1:
+            raise ValueError(f"{name}: one corner and an order of 1 or more")
+    else:
+        if len(corners) != 2 or order < 2 or order % 2:
+            raise ValueError(f"{name}: two corners and an even order")
+        if corners[0] >= corners[1]:
+            raise ValueError(f"{name}: corners must be increasing")
+    for fs in spec.get("rates", []):
+        if max(corners) >= fs / 2:
+            raise ValueError(f"{name}: {max(corners)} Hz is above the "
+                             f"Nyquist frequency at {fs} Hz")
+    if not spec.get("rates"):
+        raise ValueError(f"{name}: no rates")
+
+
+def c_float(v):
+    text = f"{v:.9g}"
+    if "." not in text and "e" not in text:
+        text += ".0"
+    return text + "f"
+
+
+def generate(spec):
+    check(spec)
+    name = spec["name"]
+    upper = name.upper()
+    rates = sorted(float(r) for r in spec["rates"])
+    tables = []
+    safe = True
+
+    for fs in rates:
+        sos = to_sos(spec, fs)
+        coeffs = cmsis(sos)
+        biggest = max(abs(c) for c in coeffs)
+        postshift = 0
+        while biggest >= (1 << postshift):
+            postshift += 1
+        gain = max(l1_gains(sos))
+        safe = safe and gain < FIXED_POINT_GAIN_MAX
+        tables.append((fs, coeffs, postshift, gain))
+
+    stages = len(to_sos(spec, rates[0]))
+    corners = ", ".join(f"{c:g}" for c in spec["corners"])
+    lines = [
+        f"// {name}: {spec['type']}, order {spec['order']}, {corners} Hz",
+        f"#define {upper}_IIR_NUMSTAGES {stages}",
+        f"#define {upper}_IIR_TABLES {len(rates)}",
+        "// Worst sum of |h[n]| after any stage is "
+        f"{max(t[3] for t in tables):.3f}",
+        f"#define {upper}_IIR_FIXED_POINT_SAFE {int(safe)}",
+        "",
+        f"static const float32_t {name}_iir_rates[{upper}_IIR_TABLES] = {{",
+        "    " + ", ".join(c_float(t[0]) for t in tables) + ",",
+        "};",
+        "",
+        f"static const int8_t {name}_iir_postshift[{upper}_IIR_TABLES] = {{",
+        "    " + ", ".join(str(t[2]) for t in tables) + ",",
+        "};",
+        "",
+    ]
+
+    def table(kind, ctype, per_stage, fmt):
+        lines.append(f"static const {ctype} {name}_iir_coeffs{kind}"
+                     f"[{upper}_IIR_TABLES][{per_stage} * "
+                     f"{upper}_IIR_NUMSTAGES] = {{")
+        for fs, coeffs, postshift, _ in tables:
+            lines.append(f"    {{ // {fs:g} Hz")
+            for s in range(0, len(coeffs), 5):
+                lines.append("        " +
+                             ", ".join(fmt(c, postshift, i)
+                                       for i, c in
+                                       enumerate(coeffs[s:s + 5])) + ",")
+            lines.append("    },")
+        lines.append("};")
+        lines.append("")
+
+    table("", "float32_t", 5, lambda c, ps, i: c_float(c))
+    table("_q31", "q31_t", 5,
+          lambda c, ps, i: str(quantize(c, 31 - ps, 32)))
+    table("_q15", "q15_t", 6,
+          lambda c, ps, i: (f"{quantize(c, 15 - ps, 16)}, 0" if i == 0
+                            else str(quantize(c, 15 - ps, 16))))
+
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("specs", help="filter specs (YAML)")
+    parser.add_argument("output", help="C header to write")
+    args = parser.parse_args()
+
+    with open(args.specs) as f:
+        specs = yaml.safe_load(f)
+
+    out = [
+        f"/* Generated by ppg_filter_gen.py from {args.specs}, do not edit */",
+        "",
+        "#pragma once",
+        "",
+    ]
+    try:
+        for spec in specs.get("filters", []):
+            out += generate(spec)
+    except (KeyError, ValueError) as e:
+        parser.error(f"{args.specs}: {e}")
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
@@ -12,13 +12,15 @@
  Green LED.
 
   These sensors use I2C to communicate, as well as a single (optional)
-  interrupt line that is not currently supported in this driver.
+  interrupt line that can be used to wake the reader when the FIFO is almost
+  full (see beginInterrupt()).
 
   Written by Peter Jansen and Nathan Seidle (SparkFun)
   BSD license, all text above must be included in any redistribution.
  *****************************************************/
 
 #include "MAX30101.hpp"
+#include "max30101_fifo.h"
 
 // Status Registers
 static const uint8_t MAX30101_INTSTAT1 = 0x00;
@@ -155,6 +157,11 @@ static uint32_t millis()
     return k_cyc_to_ms_floor32(sys_clock_tick_get());
 }
 
+static int64_t micros()
+{
+    return k_ticks_to_us_near64(k_uptime_ticks());
+}
+
 static void delay(const uint32_t ms)
 {
     k_sleep(K_MSEC(ms));
@@ -165,11 +172,31 @@ MAX30101::MAX30101()
     // Constructor
 }
 
+// For a node bound to the upstream maxim,max30101 driver, whose config starts
+// with the bus spec
 bool MAX30101::begin(const struct device *dev)
 {
     if (!dev)
         return false;
-    this->dev = dev;
+
+    const struct max3010x_config *config =
+        reinterpret_cast<const struct max3010x_config *>(dev->config);
+
+    return begin(&config->i2c);
+}
+
+// 'i2c' must outlive the object, e.g. I2C_DT_SPEC_GET() of the sensor node. A
+// node behind an I2C mux works the same, its bus is the mux channel.
+bool MAX30101::begin(const struct i2c_dt_spec *i2c)
+{
+    if (!i2c || !i2c_is_ready_dt(i2c))
+        return false;
+    this->i2c = i2c;
+    shadowValid = 0; // Nothing is known about this device's registers yet
+    loss = {};
+    temp = {};
+    configCountdown = -1;
+    atomic_set(&configMarked, 0);
 
     // Step 1: Initial Communication and Verification
     // Check that a MAX30101 is connected
@@ -184,6 +211,8 @@ bool MAX30101::begin(const struct device *dev)
     // Populate revision ID
     readRevisionID();
 
+    k_sem_init(&async.done, 0, 1);
+
     return true;
 }
 
@@ -270,8 +299,16 @@ void MAX30101::disableDIETEMPRDY(void)
 
 void MAX30101::softReset(void)
 {
+    // Anything still staged would be wiped by the reset anyway
+    staging = false;
+    shadowDirty = 0;
+    shadowBaseValid = 0;
+
     bitMask(MAX30101_MODECONFIG, MAX30101_RESET_MASK, MAX30101_RESET);
 
+    // Every configuration register is about to change under us
+    shadowValid = 0;
+
     // Poll for bit to clear, reset is then complete
     // Timeout after 100ms
     uint32_t startTime = millis();
@@ -279,8 +316,19 @@ void MAX30101::softReset(void)
     {
         uint8_t response = readRegister8(MAX30101_MODECONFIG);
         if ((response & MAX30101_RESET) == 0)
+        {
+            // All shadowed registers reset to 0x00 (datasheet pg. 10), so the
+            // cache can be primed without reading them back
+            memset(shadow, 0, sizeof(shadow));
+            for (uint8_t reg = 0; reg < SHADOW_SIZE; reg++)
+                if (isShadowed(reg))
+                    shadowValid |= BIT(reg);
+            fifoLeftover = 0; // The FIFO pointers are reset too
+            timebase.updates = 0;
+            temp.pending = false; // As is TEMP_EN
             break; // We're done!
-        delay(1);  // Let's not over burden the I2C bus
+        }
+        delay(1); // Let's not over burden the I2C bus
     }
 }
 
@@ -387,6 +435,20 @@ void MAX30101::disableSlots(void)
     writeRegister8(MAX30101_MULTILEDCONFIG2, 0);
 }
 
+// Assign the given devices to slots 1..count, leave the rest disabled and
+// switch to multi-LED mode so the FIFO holds exactly 'count' words per sample
+void MAX30101::setupSlots(const uint8_t *slots, uint8_t count)
+{
+    count = MIN(count, MAX3010x_MAX_NUM_CHANNELS);
+
+    setLEDMode(MAX30101_MODE_MULTILED);
+    disableSlots();
+    for (uint8_t i = 0; i < count; i++)
+        enableSlot(i + 1, slots[i]);
+
+    activeLEDs = count;
+}
+
 //
 // FIFO Configuration
 //
@@ -401,9 +463,17 @@ void MAX30101::setFIFOAverage(uint8_t numberOfSamples)
 // Page 15 recommends clearing FIFO before beginning a read
 void MAX30101::clearFIFO(void)
 {
-    writeRegister8(MAX30101_FIFOWRITEPTR, 0);
-    writeRegister8(MAX30101_FIFOOVERFLOW, 0);
-    writeRegister8(MAX30101_FIFOREADPTR, 0);
+    // FIFO_WR_PTR, OVF_COUNTER and FIFO_RD_PTR are contiguous
+    const uint8_t zero[3] = {0, 0, 0};
+    burstWrite(MAX30101_FIFOWRITEPTR, zero, sizeof(zero));
+
+    fifoLeftover = 0;
+    timebase.updates = 0; // Sample count continuity is lost
+
+    // Only the record being taken right now can still predate a
+    // reconfiguration
+    if (configCountdown > 1)
+        configCountdown = 1;
 }
 
 // Enable roll over if FIFO over flows
@@ -428,6 +498,94 @@ void MAX30101::setFIFOAlmostFull(uint8_t numberOfSamples)
     bitMask(MAX30101_FIFOCONFIG, MAX30101_A_FULL_MASK, numberOfSamples);
 }
 
+//
+// Interrupt-driven FIFO acquisition
+//
+
+// The INT pin is open drain and active low (datasheet pg. 13). The callback
+// only wakes the reader, all I2C traffic stays in thread context.
+void MAX30101::intHandler(
+    const struct device *port, struct gpio_callback *cb, uint32_t pins)
+{
+    struct int_context *ctx = CONTAINER_OF(cb, struct int_context, cb);
+
+    k_sem_give(&ctx->sem);
+    if (ctx->notify)
+        k_sem_give(ctx->notify);
+}
+
+// 'notify', if given, is also given on every interrupt, so one thread can
+// wait for several sensors and then poll each with waitForFIFO(K_NO_WAIT)
+bool MAX30101::beginInterrupt(
+    const struct gpio_dt_spec *intGpio, struct k_sem *notify)
+{
+    if (!intGpio || !gpio_is_ready_dt(intGpio))
+    {
+        LOG_ERR("INT GPIO not ready");
+        return false;
+    }
+
+    irq.gpio = intGpio;
+    irq.notify = notify;
+    k_sem_init(&irq.sem, 0, 1);
+
+    if (gpio_pin_configure_dt(intGpio, GPIO_INPUT))
+    {
+        LOG_ERR("Could not configure INT GPIO");
+        return false;
+    }
+
+    gpio_init_callback(&irq.cb, intHandler, BIT(intGpio->pin));
+    if (gpio_add_callback_dt(intGpio, &irq.cb))
+    {
+        LOG_ERR("Could not add INT GPIO callback");
+        return false;
+    }
+
+    if (gpio_pin_interrupt_configure_dt(intGpio, GPIO_INT_EDGE_TO_ACTIVE))
+    {
+        LOG_ERR("Could not configure INT GPIO interrupt");
+        return false;
+    }
+
+    return true;
+}
+
+// Arm the almost full interrupt so INT asserts once 'samples' are unread.
+// FIFO_A_FULL holds the number of free slots left when it fires, so only 17 to
+// 32 unread samples can be requested. 32 is excluded here because a full FIFO
+// has equal read and write pointers and check() would see it as empty.
+// Must be called after setup(), which resets the interrupt enables.
+void MAX30101::enableFIFOInterrupt(uint8_t samples)
+{
+    samples = CLAMP(samples, 17, 31);
+
+    setFIFOAlmostFull(32 - samples);
+    enableAFULL();
+
+    // Reading INTSTAT1 clears anything pending (e.g. PWR_RDY) so the pin can
+    // deassert and the next edge is a genuine A_FULL
+    getINT1();
+}
+
+// Block until the almost full interrupt fires, and acknowledge it. A_FULL is
+// only cleared by reading INTSTAT1, draining FIFO_DATA leaves it set and INT
+// low, so without the read there is never another edge. Call it before the
+// drain, a crossing during the drain then gives a new edge.
+// Returns false on timeout, in which case the caller should still drain the
+// FIFO: an edge is missed if INT was asserted before the callback was armed
+bool MAX30101::waitForFIFO(k_timeout_t timeout)
+{
+    if (!irq.gpio)
+        return false;
+
+    if (k_sem_take(&irq.sem, timeout) != 0 && gpio_pin_get_dt(irq.gpio) <= 0)
+        return false;
+
+    getINT1();
+    return true;
+}
+
 // Read the FIFO Write Pointer
 uint8_t MAX30101::getWritePointer(void)
 {
@@ -440,42 +598,170 @@ uint8_t MAX30101::getReadPointer(void)
     return (readRegister8(MAX30101_FIFOREADPTR));
 }
 
+// OVF_COUNTER as seen by the last check(), number of samples the FIFO dropped
+// (saturates at 31)
+uint8_t MAX30101::getOverflowCounter(void)
+{
+    return overflowCounter;
+}
+
+// Cumulative sample loss since begin() or resetLossStats()
+// fifoLost grows when the sensor FIFO rolls over, i.e. it is not read often
+// enough (bus or acquisition thread too slow). ringLost grows when the sense
+// ring is full, i.e. the consumer is too slow.
+void MAX30101::getLossStats(struct max30101_loss_stats *stats)
+{
+    *stats = loss;
+}
+
+// Call from the acquisition thread, or while it is idle
+void MAX30101::resetLossStats(void)
+{
+    loss = {};
+}
+
 // Die Temperature
-// Returns temp in C
-float MAX30101::readTemperature()
+//
+// A conversion takes about 29 ms (datasheet pg. 2), far too long to wait for
+// in the acquisition thread at high sample rates. startTemperature() only
+// sets TEMP_EN, pollTemperature() later collects the result. With an interval
+// set, every FIFO state read starts and collects conversions on its own, so
+// streaming picks up temperatures at no more than one extra register read per
+// batch while a conversion runs. DIE_TEMP_RDY is enabled as well, which wakes
+// an interrupt-driven reader as soon as a reading is waiting.
+//
+// Only the acquisition thread may start or poll, any thread may read the
+// result with getTemperature().
+
+static const int64_t MAX30101_TEMP_CONVERSION_US = 29000;
+static const int64_t MAX30101_TEMP_TIMEOUT_US = 100000;
+
+// Returns false if the conversion could not be started
+bool MAX30101::startTemperature(void)
 {
+    if (temp.pending)
+        return (true);
+
     // DIE_TEMP_RDY interrupt must be enabled
     // See issue 19:
     // https://github.com/sparkfun/SparkFun_MAX3010x_Sensor_Library/issues/19
+    enableDIETEMPRDY(); // From the shadow after the first time
 
-    // Step 1: Config die temperature register to take 1 temperature sample
-    writeRegister8(MAX30101_DIETEMPCONFIG, 0x01);
+    // Config die temperature register to take 1 temperature sample
+    int ret = i2cRun(MAX30101_I2C_WRITE, 1, 0, [this] {
+        return i2c_reg_write_byte_dt(i2c, MAX30101_DIETEMPCONFIG, 0x01);
+    });
+    if (ret)
+        return (false);
 
-    // Poll for bit to clear, reading is then complete
-    // Timeout after 100ms
-    uint32_t startTime = millis();
-    while (millis() - startTime < 100)
+    temp.started = micros();
+    temp.pending = true;
+
+    return (true);
+}
+
+// Returns true once the running conversion has finished and its result is
+// available from getTemperature()
+bool MAX30101::pollTemperature(void)
+{
+    if (!temp.pending)
+        return (false);
+
+    // Check to see if DIE_TEMP_RDY interrupt is set, reading it clears it
+    uint8_t response;
+    if (readRegister(MAX30101_INTSTAT2, &response) ||
+        (response & MAX30101_INT_DIE_TEMP_RDY_ENABLE) == 0)
     {
-        // uint8_t response = readRegister8(MAX30101_DIETEMPCONFIG);
-        // //Original way if ((response & 0x01) == 0) break; //We're done!
+        if (micros() - temp.started > MAX30101_TEMP_TIMEOUT_US)
+        {
+            LOG_WRN("Die temperature conversion timed out");
+            temp.pending = false;
+        }
+        return (false);
+    }
 
-        // Check to see if DIE_TEMP_RDY interrupt is set
-        uint8_t response = readRegister8(MAX30101_INTSTAT2);
-        if ((response & MAX30101_INT_DIE_TEMP_RDY_ENABLE) > 0)
-            break; // We're done!
-        delay(1);  // Let's not over burden the I2C bus
+    temp.pending = false;
+
+    // DIETEMPINT and DIETEMPFRAC are contiguous, read both at once
+    uint8_t value[2];
+    int ret = i2cRun(MAX30101_I2C_BURST_READ, sizeof(value), 0, [&] {
+        return i2c_burst_read_dt(i2c, MAX30101_DIETEMPINT, value, sizeof(value));
+    });
+    if (ret)
+        return (false);
+
+    // Datasheet pg. 23: two's complement degrees plus 1/16 degree steps
+    atomic_set(&temp.raw, (int8_t)value[0] * 16 + (value[1] & 0x0F));
+    atomic_inc(&temp.count);
+
+    return (true);
+}
+
+// Convert every 'ms' milliseconds from the FIFO reads, 0 stops. The first
+// conversion starts on the next FIFO read.
+// Call after setup(), the reset there clears the interrupt enables
+void MAX30101::setTemperatureInterval(uint32_t ms)
+{
+    temp.interval = ms * 1000;
+    temp.next = micros();
+}
+
+// Called on every FIFO state read
+void MAX30101::serviceTemperature(int64_t now)
+{
+    if (temp.pending)
+    {
+        // Nothing to find before the conversion can have finished
+        if (now - temp.started >= MAX30101_TEMP_CONVERSION_US)
+            pollTemperature();
+    }
+    else if (temp.interval > 0 && now >= temp.next)
+    {
+        temp.next = now + temp.interval;
+        startTemperature();
     }
-    // TODO How do we want to fail? With what type of error?
-    //? if(millis() - startTime >= 100) return(-999.0);
+}
+
+// Last temperature read, in degrees C
+// Returns false if no conversion has finished since begin()
+bool MAX30101::getTemperature(float *celsius)
+{
+    if (atomic_get(&temp.count) == 0)
+        return (false);
+
+    *celsius = (int32_t)atomic_get(&temp.raw) * 0.0625f;
+
+    return (true);
+}
+
+// Number of finished conversions, so a reader can tell a new one from the last
+uint32_t MAX30101::getTemperatureCount(void)
+{
+    return (atomic_get(&temp.count));
+}
+
+// Returns temp in C, -999 if the conversion did not finish
+// Blocks the calling thread, a streaming reader should use
+// setTemperatureInterval() or startTemperature() instead
+float MAX30101::readTemperature()
+{
+    if (!startTemperature())
+        return (-999.0f);
 
-    // Step 2: Read die temperature register (integer)
-    int8_t tempInt = readRegister8(MAX30101_DIETEMPINT);
-    uint8_t tempFrac =
-        readRegister8(MAX30101_DIETEMPFRAC); // Causes the clearing of the
-                                             // DIE_TEMP_RDY interrupt
+    // Poll for the conversion to finish, pollTemperature() gives up after
+    // 100ms
+    while (temp.pending)
+    {
+        delay(1); // Let's not over burden the I2C bus
+        if (pollTemperature())
+        {
+            float celsius;
+            getTemperature(&celsius);
+            return (celsius);
+        }
+    }
 
-    // Step 3: Calculate temperature (datasheet pg. 23)
-    return (float)tempInt + ((float)tempFrac * 0.0625f);
+    return (-999.0f);
 }
 
 // Returns die temp in F
@@ -534,6 +820,47 @@ void MAX30101::setup(
     softReset(); // Reset all configuration, threshold, and data registers to
                  // POR values
 
+    beginConfig(); // Build the register image locally, written out below
+    stageSetup(
+        powerLevelRed, powerLevelIR, powerLevelGreen, sampleAverage, ledMode,
+        sampleRate, pulseWidth, adcRange);
+    commitConfig(); // A handful of burst writes
+
+    clearFIFO(); // Reset the FIFO before we begin checking the sensor
+}
+
+// setup() without the reset, for a sensor that is already streaming
+// Returns 0 on success or the first I2C error
+int MAX30101::reconfigure(
+    uint8_t powerLevelRed,
+    uint8_t powerLevelIR,
+    uint8_t powerLevelGreen,
+    uint8_t sampleAverage,
+    uint8_t ledMode,
+    int sampleRate,
+    int pulseWidth,
+    int adcRange)
+{
+    beginConfig();
+    stageSetup(
+        powerLevelRed, powerLevelIR, powerLevelGreen, sampleAverage, ledMode,
+        sampleRate, pulseWidth, adcRange);
+
+    return (reconfigure());
+}
+
+// The register image setup() and reconfigure() write, every field is set so
+// nothing depends on what the device held before
+void MAX30101::stageSetup(
+    uint8_t powerLevelRed,
+    uint8_t powerLevelIR,
+    uint8_t powerLevelGreen,
+    uint8_t sampleAverage,
+    uint8_t ledMode,
+    int sampleRate,
+    int pulseWidth,
+    int adcRange)
+{
     // FIFO Configuration
     //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
     // The chip will average multiple samples of same type together if you wish
@@ -633,6 +960,7 @@ void MAX30101::setup(
 
     // Multi-LED Mode Configuration, Enable the reading of the three LEDs
     //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+    disableSlots(); // Fewer LEDs than before must not leave a slot behind
     enableSlot(1, SLOT_RED_LED);
     if (ledMode > 1)
         enableSlot(2, SLOT_IR_LED);
@@ -642,8 +970,6 @@ void MAX30101::setup(
     // enableSlot(2, SLOT_IR_PILOT);
     // enableSlot(3, SLOT_GREEN_PILOT);
     //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-
-    clearFIFO(); // Reset the FIFO before we begin checking the sensor
 }
 
 void MAX30101::setupSpO2(
@@ -661,6 +987,8 @@ void MAX30101::setupSpO2(
     softReset(); // Reset all configuration, threshold, and data registers to
                  // POR values
 
+    beginConfig(); // Build the register image locally, written out below
+
     // FIFO Configuration
     //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
     // The chip will average multiple samples of same type together if you wish
@@ -710,6 +1038,8 @@ void MAX30101::setupSpO2(
     enableSlot(2, SLOT_IR_LED);
     //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 
+    commitConfig(); // A handful of burst writes
+
     clearFIFO(); // Reset the FIFO before we begin checking the sensor
 }
 
@@ -717,14 +1047,23 @@ void MAX30101::setupSpO2(
 // Data Collection
 //
 
+//
+// The sense ring
+//
+// Single producer (check() / finishCheck()), single consumer (available(),
+// getFIFO*(), nextSample(), getSamples(), consumeSamples()). head and tail
+// are free running counters, each written by one side only, and the slots
+// between them belong to the consumer. The producer publishes new samples by
+// storing head after the data, the consumer releases slots by storing tail
+// after it is done with them, so the two sides can run in different threads
+// without a lock. The counters are only ever computed on as uint32_t, so they
+// wrap instead of overflowing the signed atomic_val_t.
+//
+
 // Tell caller how many samples are available
-uint8_t MAX30101::available(void)
+uint16_t MAX30101::available(void)
 {
-    int8_t numberOfSamples = sense.head - sense.tail;
-    if (numberOfSamples < 0)
-        numberOfSamples += STORAGE_SIZE;
-
-    return (numberOfSamples);
+    return ((uint32_t)atomic_get(&sense.head) - (uint32_t)atomic_get(&sense.tail));
 }
 
 // Report the most recent red value
@@ -732,7 +1071,7 @@ uint32_t MAX30101::getRed(void)
 {
     // Check the sensor for new data for 250ms
     if (safeCheck(250))
-        return (sense.red[sense.head]);
+        return (sense.red[newest()]);
     else
         return (0); // Sensor failed to find new data
 }
@@ -742,7 +1081,7 @@ uint32_t MAX30101::getIR(void)
 {
     // Check the sensor for new data for 250ms
     if (safeCheck(250))
-        return (sense.IR[sense.head]);
+        return (sense.IR[newest()]);
     else
         return (0); // Sensor failed to find new data
 }
@@ -752,7 +1091,7 @@ uint32_t MAX30101::getGreen(void)
 {
     // Check the sensor for new data for 250ms
     if (safeCheck(250))
-        return (sense.green[sense.head]);
+        return (sense.green[newest()]);
     else
         return (0); // Sensor failed to find new data
 }
@@ -760,29 +1099,306 @@ uint32_t MAX30101::getGreen(void)
 // Report the next Red value in the FIFO
 uint32_t MAX30101::getFIFORed(void)
 {
-    return (sense.red[sense.tail]);
+    return (sense.red[(uint32_t)atomic_get(&sense.tail) & STORAGE_MASK]);
 }
 
 // Report the next IR value in the FIFO
 uint32_t MAX30101::getFIFOIR(void)
 {
-    return (sense.IR[sense.tail]);
+    return (sense.IR[(uint32_t)atomic_get(&sense.tail) & STORAGE_MASK]);
 }
 
 // Report the next Green value in the FIFO
 uint32_t MAX30101::getFIFOGreen(void)
 {
-    return (sense.green[sense.tail]);
+    return (sense.green[(uint32_t)atomic_get(&sense.tail) & STORAGE_MASK]);
 }
 
 // Advance the tail
 void MAX30101::nextSample(void)
 {
-    if (available()) // Only advance the tail if new data is available
+    consumeSamples(1);
+}
+
+// Index of the most recently stored sample
+uint16_t MAX30101::newest(void)
+{
+    return ((uint32_t)atomic_get(&sense.head) - 1) & STORAGE_MASK;
+}
+
+// Hand out every unread sample at once as at most two runs of contiguous
+// per-channel arrays (before and after the wrap of the sense array)
+// Channels that are not active hold stale data
+// Returns the number of runs filled in, 0 if nothing is available
+uint8_t MAX30101::getSamples(struct max30101_samples runs[2])
+{
+    uint16_t pending = available();
+    uint32_t tail = (uint32_t)atomic_get(&sense.tail);
+    uint16_t start = tail & STORAGE_MASK;
+    uint8_t runCount = 0;
+
+    // Published before head, so it is current for everything available()
+    bool marked = atomic_get(&configMarked) != 0;
+    uint32_t mark = (uint32_t)atomic_get(&configMark);
+
+    while (pending > 0)
+    {
+        uint16_t count = MIN(pending, STORAGE_SIZE - start);
+
+        runs[runCount].red = &sense.red[start];
+        runs[runCount].ir = &sense.IR[start];
+        runs[runCount].green = &sense.green[start];
+        runs[runCount].timestamp = &sense.timestamp[start];
+#ifdef CONFIG_APP_PPG_GAP_MARKERS
+        runs[runCount].gap = &sense.gap[start];
+#endif
+        runs[runCount].count = count;
+        runs[runCount].configStart = -1;
+        if (marked && mark - tail < count)
+            runs[runCount].configStart = mark - tail;
+        runCount++;
+
+        tail += count;
+        pending -= count;
+        start = 0;
+    }
+
+    return runCount;
+}
+
+// Mark 'count' samples as consumed, the batch counterpart of nextSample()
+void MAX30101::consumeSamples(uint16_t count)
+{
+    count = MIN(count, available());
+    atomic_set(&sense.tail,
+               (atomic_val_t)((uint32_t)atomic_get(&sense.tail) + count));
+}
+
+// Number of samples read from the sensor but dropped because the sense ring
+// was full, i.e. the consumer fell more than STORAGE_SIZE samples behind
+uint32_t MAX30101::getRingOverruns(void)
+{
+    return loss.ringLost;
+}
+
+// Read the FIFO state and work out how many samples are waiting
+// FIFO_WR_PTR, OVF_COUNTER and FIFO_RD_PTR are contiguous (0x04 - 0x06), so
+// the whole FIFO state comes in a single transaction
+int MAX30101::readFIFOState(void)
+{
+    if (burstRead(MAX30101_FIFOWRITEPTR, 3) != 3)
+        return (0);
+
+    uint8_t writePointer = burstRead_next() & 0x1F;
+    overflowCounter = burstRead_next() & 0x1F;
+    uint8_t readPointer = burstRead_next() & 0x1F;
+    int64_t now = micros();
+
+    // Calculate the number of readings we need to get from sensor
+    int numberOfSamples = writePointer - readPointer;
+    if (numberOfSamples < 0)
+        numberOfSamples += 32; // Wrap condition
+
+    // Equal pointers mean empty, unless samples have been lost, in which case
+    // the FIFO is full
+    if (numberOfSamples == 0 && overflowCounter > 0)
+        numberOfSamples = 32;
+
+    // OVF_COUNTER clears once we pop a sample, so each read reports the
+    // samples lost since the previous batch. They were the oldest, so the gap
+    // sits in front of this batch.
+    if (numberOfSamples > 0)
+        loss.batches++;
+    if (overflowCounter > 0)
+    {
+        loss.overflowBatches++;
+        loss.fifoLost += overflowCounter;
+        // The lost records were ahead of the first reconfigured one
+        if (configCountdown > 0)
+            configCountdown = MAX(configCountdown - overflowCounter, 0);
+#ifdef CONFIG_APP_PPG_GAP_MARKERS
+        pendingGap += overflowCounter;
+#endif
+    }
+
+    updateTimebase(now, numberOfSamples);
+    serviceTemperature(now);
+
+    return (numberOfSamples);
+}
+
+// Sample period the configuration asks for: the ADC rate divided by the FIFO
+// averaging (datasheet Tables 3 and 11)
+float MAX30101::nominalSamplePeriod(void)
+{
+    static const uint16_t rates[] = {50, 100, 200, 400, 800, 1000, 1600, 3200};
+
+    // Straight from the shadow, this runs once per batch and must not count as
+    // a cache hit
+    uint8_t fifoConfig = (shadowValid & BIT(MAX30101_FIFOCONFIG))
+                             ? shadow[MAX30101_FIFOCONFIG]
+                             : readShadow(MAX30101_FIFOCONFIG);
+    uint8_t particleConfig = (shadowValid & BIT(MAX30101_PARTICLECONFIG))
+                                 ? shadow[MAX30101_PARTICLECONFIG]
+                                 : readShadow(MAX30101_PARTICLECONFIG);
+
+    uint8_t average = 1 << MIN(fifoConfig >> 5, 5);
+    uint16_t rate = rates[(particleConfig >> 2) & 0x07];
+
+    return (1e6f * average / rate);
+}
+
+// Account for the samples the sensor wrote since the last FIFO state read,
+// 'pending' samples are waiting now
+// Lost samples count too, they took sensor time. The model starts over when
+// the configuration changes or OVF_COUNTER saturates and the loss is unknown.
+void MAX30101::updateTimebase(int64_t now, int pending)
+{
+    float nominal = nominalSamplePeriod();
+
+    if (nominal != timebase.nominal_us || overflowCounter == 0x1F)
+        max30101_timebase_reset(&timebase, nominal);
+
+    int written = pending + overflowCounter - fifoLeftover;
+    max30101_timebase_update(&timebase, now, MAX(written, 0));
+    fifoLeftover = pending;
+}
+
+// Measured time between samples, in microseconds of the MCU clock
+float MAX30101::getSamplePeriod(void)
+{
+    return (timebase.period_us);
+}
+
+// Measured output data rate, in samples per second of the MCU clock
+float MAX30101::getSampleRate(void)
+{
+    if (timebase.period_us <= 0)
+        return (0); // Nothing read yet
+
+    return (1e6f / timebase.period_us);
+}
+
+// Sensor oscillator error against the MCU clock in ppm, positive when the
+// sensor runs slow
+float MAX30101::getClockDrift(void)
+{
+    if (timebase.nominal_us <= 0)
+        return (0);
+
+    return (max30101_timebase_drift_ppm(&timebase));
+}
+
+// Read up to maxSamples pending records in one burst, for callers that
+// decode the data themselves (see MAX30101Storage.hpp)
+// Returns the raw FIFO bytes, valid until the next read, or nullptr if there
+// is nothing to read or 'channels' does not match the sensor configuration
+const uint8_t *MAX30101::readFIFO(
+    uint8_t channels, int maxSamples, int *numberOfSamples)
+{
+    *numberOfSamples = 0;
+
+    if (channels != activeLEDs)
     {
-        sense.tail++;
-        sense.tail %= STORAGE_SIZE; // Wrap condition
+        LOG_ERR(
+            "Storage has %d channels, sensor is set up for %d", channels,
+            activeLEDs);
+        return nullptr;
     }
+
+    int toRead = MIN(readFIFOState(), maxSamples);
+    if (toRead <= 0)
+        return nullptr;
+
+    uint16_t size = toRead * channels * 3;
+    if (burstRead(MAX30101_FIFODATA, size) != size)
+        return nullptr;
+
+    fifoLeftover -= toRead;
+    *numberOfSamples = toRead;
+    return burst_read_buffer[burst_read_active];
+}
+
+// Unpack 'size' bytes of FIFO data from the active burst buffer into the
+// sense array
+// The ring is filled in at most two contiguous runs (before and after the
+// wrap), each decoded in one pass by max30101_fifo_unpack(). The FIFO is
+// always drained, samples that do not fit in the ring are counted in
+// overruns and dropped.
+// Returns the number of samples stored
+int MAX30101::unpackSamples(int size)
+{
+    // Never decode past what the last burst actually returned
+    size = MIN(size, burst_read_buffer_used - burst_read_buffer_i);
+
+    const uint8_t *fifo =
+        &burst_read_buffer[burst_read_active][burst_read_buffer_i];
+    int numberOfSamples = size / (activeLEDs * 3);
+    burst_read_buffer_i += numberOfSamples * activeLEDs * 3;
+
+    // Age of the oldest sample in this burst, relative to the newest one the
+    // FIFO held when its state was read
+    int age = fifoLeftover - 1;
+    fifoLeftover = MAX(fifoLeftover - numberOfSamples, 0);
+
+    uint32_t head = (uint32_t)atomic_get(&sense.head);
+    int space = STORAGE_SIZE - (int)(head - (uint32_t)atomic_get(&sense.tail));
+    int dropped = MAX(numberOfSamples - space, 0);
+
+    // Place the reconfiguration marker if its record is in this burst. If
+    // it was dropped, the next stored sample is just as new.
+    if (configCountdown >= 0)
+    {
+        if (configCountdown < numberOfSamples)
+        {
+            atomic_set(
+                &configMark,
+                (atomic_val_t)(head + MIN(configCountdown, numberOfSamples - dropped)));
+            atomic_inc(&configMarked);
+            configCountdown = -1;
+        }
+        else
+        {
+            configCountdown -= numberOfSamples;
+        }
+    }
+
+    numberOfSamples -= dropped;
+    loss.ringLost += dropped;
+
+    int first = head & STORAGE_MASK;
+    int run = MIN(numberOfSamples, STORAGE_SIZE - first);
+
+    uint32_t *const toEnd[] = {
+        &sense.red[first], &sense.IR[first], &sense.green[first]};
+    fifo += max30101_fifo_unpack(fifo, run, activeLEDs, toEnd);
+
+    uint32_t *const fromStart[] = {sense.red, sense.IR, sense.green};
+    max30101_fifo_unpack(fifo, numberOfSamples - run, activeLEDs, fromStart);
+
+    for (int i = 0; i < numberOfSamples; i++)
+    {
+        sense.timestamp[(first + i) & STORAGE_MASK] =
+            (uint32_t)max30101_timebase_at(&timebase, MAX(age - i, 0));
+    }
+
+#ifdef CONFIG_APP_PPG_GAP_MARKERS
+    // The first stored sample carries everything lost before it, samples
+    // dropped here are at the end of the batch and mark the next one
+    if (numberOfSamples > 0)
+    {
+        memset(&sense.gap[first], 0, run);
+        memset(sense.gap, 0, numberOfSamples - run);
+        sense.gap[first] = MIN(pendingGap, UINT8_MAX);
+        pendingGap = 0;
+    }
+    pendingGap += dropped;
+#endif
+
+    // Publish only once the data is in place
+    atomic_set(&sense.head, (atomic_val_t)(head + numberOfSamples));
+
+    return (numberOfSamples);
 }
 
 // Polls the sensor for new data
@@ -794,29 +1410,21 @@ uint16_t MAX30101::check(void)
     // Read register FIDO_DATA in (3-uint8_t * number of active LED) chunks
     // Until FIFO_RD_PTR = FIFO_WR_PTR
 
-    uint8_t readPointer = getReadPointer();
-    uint8_t writePointer = getWritePointer();
-
-    int numberOfSamples = 0;
+    int numberOfSamples = readFIFOState();
+    int stored = 0;
 
     // Do we have new data?
-    if (readPointer != writePointer)
+    if (numberOfSamples > 0)
     {
-        // Calculate the number of readings we need to get from sensor
-        numberOfSamples = writePointer - readPointer;
-        if (numberOfSamples < 0)
-            numberOfSamples += 32; // Wrap condition
-
         // We now have the number of readings, now calc uint8_ts to read
         // For this example we are just doing Red and IR (3 uint8_ts each)
         int uint8_tsLeftToRead = numberOfSamples * activeLEDs * 3;
 
         // Get ready to read a burst of data from the FIFO register
 
-        // We may need to read as many as 288 uint8_ts so we read in blocks no
-        // larger than I2C_BUFFER_LENGTH I2C_BUFFER_LENGTH changes based on the
-        // platform. 64 uint8_ts for SAMD21, 32 uint8_ts for Uno.
-        // Wire.requestFrom() is limited to BUFFER_LENGTH which is 32 on the Uno
+        // I2C_BUFFER_LENGTH covers a full FIFO with all three LEDs active, so
+        // this is normally a single burst. The loop is kept in case the buffer
+        // is ever shrunk to suit a controller with a smaller transfer limit.
         while (uint8_tsLeftToRead > 0)
         {
             int toGet = uint8_tsLeftToRead;
@@ -838,69 +1446,121 @@ uint16_t MAX30101::check(void)
             // Request toGet number of uint8_ts from sensor
             burstRead(MAX30101_FIFODATA, toGet);
 
-            while (toGet > 0)
-            {
-                sense.head++;               // Advance the head of the storage struct
-                sense.head %= STORAGE_SIZE; // Wrap condition
+            stored += unpackSamples(toGet);
+
+        } // End while (uint8_tsLeftToRead > 0)
+
+    } // End numberOfSamples > 0
 
-                uint8_t temp[sizeof(uint32_t)]; // Array of 4 uint8_ts that we
-                                                // will convert into long
-                uint32_t tempLong;
+    return (stored); // Let the world know how much new data we found
+}
 
-                // Burst read three uint8_ts - RED
-                temp[3] = 0;
-                temp[2] = burstRead_next();
-                temp[1] = burstRead_next();
-                temp[0] = burstRead_next();
+//
+// Asynchronous FIFO reads
+//
+// startCheck() reads the FIFO state (one short blocking transaction) and puts
+// the sample data transfer on the bus into the idle burst buffer, then returns.
+// The caller works on the samples it already has and calls finishCheck() to
+// wait for the transfer and unpack it. Without CONFIG_I2C_CALLBACK, or if the
+// bus driver does not implement it, startCheck() reads synchronously and
+// finishCheck() just unpacks.
+//
+// No other register access may be made on this sensor between the two calls.
+//
 
-                // Convert array to long
-                memcpy(&tempLong, temp, sizeof(tempLong));
+void MAX30101::asyncHandler(const struct device *bus, int result, void *data)
+{
+    MAX30101 *self = static_cast<MAX30101 *>(data);
 
-                tempLong &= 0x3FFFF; // Zero out all but 18 bits
+    self->async.end = k_cycle_get_32();
+    self->async.result = result;
+    k_sem_give(&self->async.done);
+}
 
-                sense.red[sense.head] =
-                    tempLong; // Store this reading into the sense array
+// Returns the number of samples being transferred, 0 if there is nothing to
+// read or a transfer is already pending
+uint16_t MAX30101::startCheck(void)
+{
+    if (async.busy)
+        return (0);
 
-                if (activeLEDs > 1)
-                {
-                    // Burst read three more uint8_ts - IR
-                    temp[3] = 0;
-                    temp[2] = burstRead_next();
-                    temp[1] = burstRead_next();
-                    temp[0] = burstRead_next();
+    int numberOfSamples = readFIFOState();
+    if (numberOfSamples == 0)
+        return (0);
 
-                    // Convert array to long
-                    memcpy(&tempLong, temp, sizeof(tempLong));
+    // A full FIFO with three LEDs is 32 x 9 = 288 bytes, always one burst
+    async.buffer = !burst_read_active;
+    async.size = numberOfSamples * activeLEDs * 3;
+    async.busy = true;
+    k_sem_reset(&async.done);
+    async.start = k_cycle_get_32();
 
-                    tempLong &= 0x3FFFF; // Zero out all but 18 bits
+#ifdef CONFIG_I2C_CALLBACK
+    async.reg = MAX30101_FIFODATA;
+    async.msgs[0].buf = &async.reg;
+    async.msgs[0].len = 1;
+    async.msgs[0].flags = I2C_MSG_WRITE;
+    async.msgs[1].buf = burst_read_buffer[async.buffer];
+    async.msgs[1].len = async.size;
+    async.msgs[1].flags = I2C_MSG_RESTART | I2C_MSG_READ | I2C_MSG_STOP;
 
-                    sense.IR[sense.head] = tempLong;
-                }
+    int ret = i2c_transfer_cb_dt(i2c, async.msgs, 2, asyncHandler, this);
+    if (ret != -ENOSYS)
+    {
+        if (ret)
+        {
+            LOG_ERR("Could not start FIFO read (%d)", ret);
+            i2cRecord(
+                MAX30101_I2C_BURST_READ, async.size,
+                k_cycle_get_32() - async.start, ret);
+            async.busy = false;
+            return (0);
+        }
+        return (numberOfSamples);
+    }
+#endif
 
-                if (activeLEDs > 2)
-                {
-                    // Burst read three more uint8_ts - Green
-                    temp[3] = 0;
-                    temp[2] = burstRead_next();
-                    temp[1] = burstRead_next();
-                    temp[0] = burstRead_next();
+    // No callback support on this bus, do the read now
+    async.result = i2c_burst_read_dt(
+        i2c, MAX30101_FIFODATA, burst_read_buffer[async.buffer], async.size);
+    async.end = k_cycle_get_32();
+    k_sem_give(&async.done);
 
-                    // Convert array to long
-                    memcpy(&tempLong, temp, sizeof(tempLong));
+    return (numberOfSamples);
+}
 
-                    tempLong &= 0x3FFFF; // Zero out all but 18 bits
+// Wait for the transfer started by startCheck() and unpack it into the sense
+// array
+// Returns the number of new samples, 0 if nothing was pending, the transfer
+// failed or it did not complete within timeout (call again later)
+uint16_t MAX30101::finishCheck(k_timeout_t timeout)
+{
+    if (!async.busy)
+        return (0);
 
-                    sense.green[sense.head] = tempLong;
-                }
+    if (k_sem_take(&async.done, timeout))
+        return (0);
 
-                toGet -= activeLEDs * 3;
-            }
+    async.busy = false;
 
-        } // End while (uint8_tsLeftToRead > 0)
+    // Latency is start to completion, not counting how late we came to look
+    i2cRecord(
+        MAX30101_I2C_BURST_READ, async.size, async.end - async.start,
+        async.result);
 
-    } // End readPtr != writePtr
+    if (async.result)
+    {
+        LOG_ERR("Could not burst read %d bytes", async.size);
+        return (0);
+    }
 
-    return (numberOfSamples); // Let the world know how much new data we found
+    // The filled buffer becomes the active one, the other is free for the
+    // next transfer
+    burst_read_active = async.buffer;
+    burst_read_buffer_i = 0;
+    burst_read_buffer_used = async.size;
+
+    return (unpackSamples(async.size));
 }
 
 // Check for new data but give up after a certain amount of time
@@ -950,10 +1610,12 @@ uint8_t MAX30101::getPAGreen()
 }
 
 // Given a register, read it, mask it, and then set the thing
+// Shadowed configuration registers are read from the cache, so this is
+// normally a single write on the bus
 void MAX30101::bitMask(uint8_t reg, uint8_t mask, uint8_t thing)
 {
     // Grab current register context
-    uint8_t originalContents = readRegister8(reg);
+    uint8_t originalContents = readShadow(reg);
 
     // Zero-out the portions of the register we're interested in
     originalContents = originalContents & mask;
@@ -962,36 +1624,354 @@ void MAX30101::bitMask(uint8_t reg, uint8_t mask, uint8_t thing)
     writeRegister8(reg, originalContents | thing);
 }
 
+//
+// Shadow register cache
+//
+
+// Configuration registers that only change when we write them. Status, FIFO
+// and self-clearing registers (e.g. DIETEMPCONFIG) always go to the bus.
+bool MAX30101::isShadowed(uint8_t reg)
+{
+    switch (reg)
+    {
+    case MAX30101_INTENABLE1:
+    case MAX30101_INTENABLE2:
+    case MAX30101_FIFOCONFIG:
+    case MAX30101_MODECONFIG:
+    case MAX30101_PARTICLECONFIG:
+    case MAX30101_LED1_PULSEAMP:
+    case MAX30101_LED2_PULSEAMP:
+    case MAX30101_LED3_PULSEAMP:
+    case MAX30101_LED_PROX_AMP:
+    case MAX30101_MULTILEDCONFIG1:
+    case MAX30101_MULTILEDCONFIG2:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Current value of a register, from the cache when we have it
+uint8_t MAX30101::readShadow(uint8_t reg)
+{
+    if (isShadowed(reg) && (shadowValid & BIT(reg)))
+    {
+        i2cStats.avoided++;
+        return shadow[reg];
+    }
+
+    uint8_t value;
+    if (readRegister(reg, &value))
+        return 0;
+
+    if (isShadowed(reg))
+    {
+        shadow[reg] = value;
+        shadowValid |= BIT(reg);
+    }
+
+    return value;
+}
+
+// Contiguous runs of writable configuration registers (datasheet pg. 10).
+// 0x0F is reserved, so the LED amplitudes and the proximity/slot registers
+// are separate runs.
+static const struct
+{
+    uint8_t first;
+    uint8_t last;
+} CONFIG_BLOCKS[] = {
+    {MAX30101_INTENABLE1, MAX30101_INTENABLE2},
+    {MAX30101_FIFOCONFIG, MAX30101_PARTICLECONFIG},
+    {MAX30101_LED1_PULSEAMP, MAX30101_LED3_PULSEAMP},
+    {MAX30101_LED_PROX_AMP, MAX30101_MULTILEDCONFIG2},
+};
+
+// Start staging configuration changes
+// Until commitConfig(), writes to shadowed registers (including every set*,
+// enable* and bitMask() based call) only update the shadow copy
+void MAX30101::beginConfig(void)
+{
+    if (!staging)
+        previousLEDs = activeLEDs;
+    staging = true;
+}
+
+// Write out everything staged since beginConfig(), one burst per block of
+// contiguous registers that has changed
+// Returns 0 on success or the first I2C error
+int MAX30101::commitConfig(void)
+{
+    int ret = 0;
+
+    staging = false;
+
+    // Registers staged back to the value they started with need no write
+    for (uint8_t reg = 0; reg < SHADOW_SIZE; reg++)
+        if ((shadowDirty & shadowBaseValid & BIT(reg)) &&
+            shadow[reg] == shadowBase[reg])
+            shadowDirty &= ~BIT(reg);
+    shadowBaseValid = 0;
+
+    for (const auto &block : CONFIG_BLOCKS)
+    {
+        uint8_t first = block.first;
+        uint8_t last = block.last;
+
+        // Trim unchanged registers off both ends of the block
+        while (first <= last && !(shadowDirty & BIT(first)))
+            first++;
+        while (last > first && !(shadowDirty & BIT(last)))
+            last--;
+        if (first > last)
+            continue;
+
+        // Unchanged registers in the middle get rewritten with their current
+        // value, so make sure we know it
+        for (uint8_t reg = first; reg <= last; reg++)
+            readShadow(reg);
+
+        int err = burstWrite(first, &shadow[first], last - first + 1);
+        if (err)
+        {
+            for (uint8_t reg = first; reg <= last; reg++)
+                shadowValid &= ~BIT(reg);
+            if (!ret)
+                ret = err;
+        }
+    }
+
+    shadowDirty = 0;
+
+    return ret;
+}
+
+// Commit what was staged since beginConfig() to a running sensor
+//
+// Records already in the FIFO were taken under the old configuration, the one
+// being taken while the registers change may mix both, so the marker goes on
+// the record after that. If the number of LEDs changes, the record layout
+// changes too and old and new records can't share the FIFO: it is drained
+// before the commit and whatever lands in it during the commit is discarded
+// and counted as lost.
+//
+// Call from the acquisition thread, after beginConfig(). Returns 0 on
+// success, -EINVAL if no configuration is being staged, or the first I2C
+// error.
+int MAX30101::reconfigure(void)
+{
+    // Without beginConfig() previousLEDs is stale, and so would be the layout
+    if (!staging)
+        return -EINVAL;
+
+    uint8_t newLEDs = activeLEDs;
+    bool newLayout = newLEDs != previousLEDs;
+
+    if (newLayout)
+    {
+        activeLEDs = previousLEDs;
+        check(); // Staged writes don't touch the FIFO
+        activeLEDs = newLEDs;
+    }
+
+    int ret = commitConfig();
+    if (ret)
+        return ret;
+
+    if (newLayout)
+    {
+        int stale = readFIFOState();
+        clearFIFO();
+        loss.fifoLost += stale;
+#ifdef CONFIG_APP_PPG_GAP_MARKERS
+        pendingGap += stale;
+#endif
+        configCountdown = 1;
+    }
+    else
+    {
+        configCountdown = readFIFOState() + 1;
+    }
+
+    return 0;
+}
+
+// Bus transactions saved by the shadow cache since the last reset
+uint32_t MAX30101::getI2CTransactionsAvoided()
+{
+    return i2cStats.avoided;
+}
+
 //
 // Low-level I2C Communication
 //
+
+// Number of I2C transactions issued since the last reset, every register
+// access and burst counts as one
+uint32_t MAX30101::getI2CTransactionCount()
+{
+    uint32_t count = 0;
+
+    for (const auto &op : i2cStats.op)
+        count += op.transactions;
+
+    return count;
+}
+
+void MAX30101::resetI2CTransactionCount()
+{
+    resetI2CStats();
+}
+
+// Per transfer kind counters and latency histograms, to tell a saturated bus
+// from slow processing. The acquisition thread updates them without locking,
+// so a copy taken from another thread may be off by the transfer in flight.
+void MAX30101::getI2CStats(struct max30101_i2c_stats *stats)
+{
+    *stats = i2cStats;
+}
+
+void MAX30101::resetI2CStats(void)
+{
+    i2cStats = {};
+}
+
+void MAX30101::i2cRecord(
+    enum max30101_i2c_op op, uint16_t bytes, uint32_t cycles, int ret)
+{
+    struct max30101_i2c_op_stats &stats = i2cStats.op[op];
+    uint32_t us = k_cyc_to_us_floor32(cycles);
+    uint8_t bucket = 0;
+
+    for (uint32_t t = us >> 4; t && bucket < MAX30101_I2C_LATENCY_BUCKETS - 1;
+         t >>= 1)
+        bucket++;
+
+    stats.transactions++;
+    stats.busyUs += us;
+    stats.maxUs = MAX(stats.maxUs, us);
+    stats.latency[bucket]++;
+    if (ret)
+        stats.errors++;
+    else
+        stats.bytes += bytes;
+}
+
+// Run one transfer, timed, and try again up to 'retries' times if it fails.
+// Only idempotent transfers may be retried: reading a status or FIFO register
+// changes it, even when the transfer then fails.
+template <typename Transfer>
+int MAX30101::i2cRun(
+    enum max30101_i2c_op op, uint16_t bytes, int retries, Transfer transfer)
+{
+    int ret;
+
+    while (true)
+    {
+        uint32_t start = k_cycle_get_32();
+        ret = transfer();
+        i2cRecord(op, bytes, k_cycle_get_32() - start, ret);
+
+        if (ret == 0 || retries-- <= 0)
+            break;
+        i2cStats.op[op].retries++;
+    }
+
+    return ret;
+}
+
 uint8_t MAX30101::readRegister8(uint8_t reg)
 {
-    const struct max3010x_config *config =
-        reinterpret_cast<const struct max3010x_config *>(dev->config);
     uint8_t value;
-    if (i2c_reg_read_byte_dt(&config->i2c, reg, &value))
+    if (readRegister(reg, &value))
     {
         return 0;
     }
     return value;
 }
 
+int MAX30101::readRegister(uint8_t reg, uint8_t *value)
+{
+    // Configuration and ID registers read the same every time
+    int retries = (isShadowed(reg) || reg >= MAX30101_REVISIONID)
+                      ? CONFIG_APP_PPG_I2C_RETRIES
+                      : 0;
+
+    return i2cRun(MAX30101_I2C_READ, 1, retries, [&] {
+        return i2c_reg_read_byte_dt(i2c, reg, value);
+    });
+}
+
 void MAX30101::writeRegister8(uint8_t reg, uint8_t value)
 {
-    const struct max3010x_config *config =
-        reinterpret_cast<const struct max3010x_config *>(dev->config);
-    i2c_reg_write_byte_dt(&config->i2c, reg, value);
+    if (staging && isShadowed(reg))
+    {
+        if (!(shadowDirty & BIT(reg)) && (shadowValid & BIT(reg)))
+        {
+            shadowBase[reg] = shadow[reg];
+            shadowBaseValid |= BIT(reg);
+        }
+        shadow[reg] = value;
+        shadowValid |= BIT(reg);
+        shadowDirty |= BIT(reg);
+        i2cStats.avoided++;
+        return;
+    }
+
+    // Writing the same value again is harmless, except to self-clearing
+    // registers (e.g. RESET, TEMP_EN) which have no business failing anyway
+    int ret = i2cRun(
+        MAX30101_I2C_WRITE, 1, CONFIG_APP_PPG_I2C_RETRIES,
+        [&] { return i2c_reg_write_byte_dt(i2c, reg, value); });
+
+    if (isShadowed(reg))
+    {
+        // On failure we no longer know what the register holds
+        if (ret == 0)
+        {
+            shadow[reg] = value;
+            shadowValid |= BIT(reg);
+        }
+        else
+        {
+            shadowValid &= ~BIT(reg);
+        }
+    }
 }
 
-uint8_t MAX30101::burstRead(uint8_t reg, uint16_t size)
+// Write 'size' consecutive registers starting at 'reg' in one transaction
+// The register address and data go out as a single message, which every I2C
+// controller handles (unlike i2c_burst_write())
+int MAX30101::burstWrite(uint8_t reg, const uint8_t *data, uint8_t size)
 {
-    const struct max3010x_config *config =
-        reinterpret_cast<const struct max3010x_config *>(dev->config);
+    uint8_t buf[1 + BURST_WRITE_MAX];
 
+    if (size > BURST_WRITE_MAX)
+        return -EINVAL;
+
+    buf[0] = reg;
+    memcpy(&buf[1], data, size);
+
+    int ret = i2cRun(
+        MAX30101_I2C_BURST_WRITE, size, CONFIG_APP_PPG_I2C_RETRIES,
+        [&] { return i2c_write_dt(i2c, buf, size + 1); });
+    if (ret)
+    {
+        LOG_ERR("Could not burst write %d bytes", size);
+    }
+
+    return ret;
+}
+
+uint16_t MAX30101::burstRead(uint8_t reg, uint16_t size)
+{
     burst_read_buffer_i = 0;
     burst_read_buffer_used = 0;
-    if (i2c_burst_read_dt(&config->i2c, reg, burst_read_buffer, size))
+    int ret = i2cRun(MAX30101_I2C_BURST_READ, size, 0, [&] {
+        return i2c_burst_read_dt(
+            i2c, reg, burst_read_buffer[burst_read_active], size);
+    });
+    if (ret)
     {
         LOG_ERR("Could not burst read %d bytes", size);
         return 0;
@@ -1005,7 +1985,7 @@ uint8_t MAX30101::burstRead_next()
 {
     if (burst_read_buffer_i < burst_read_buffer_used)
     {
-        return burst_read_buffer[burst_read_buffer_i++];
+        return burst_read_buffer[burst_read_active][burst_read_buffer_i++];
     }
     else
         return 0;
@@ -12,7 +12,8 @@
  Green LED.
 
  These sensors use I2C to communicate, as well as a single (optional)
- interrupt line that is not currently supported in this driver.
+ interrupt line that can be used to wake the reader when the FIFO is almost
+ full (see beginInterrupt()).
 
  Written by Peter Jansen and Nathan Seidle (SparkFun)
  BSD license, all text above must be included in any redistribution.
@@ -21,10 +22,14 @@
 #pragma once
 
 #include <stdint.h>
+#include <zephyr/kernel.h>
 #include <zephyr/device.h>
+#include <zephyr/sys/atomic.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/i2c.h>
 
+#include "max30101_timebase.h"
+
 #define MAX3010x_MAX_NUM_CHANNELS 3
 
 enum max3010x_mode {
@@ -52,12 +57,68 @@ struct max3010x_config {
     enum max3010x_slot slot[4];
 };
 
+// One contiguous run of unread samples, see MAX30101::getSamples()
+struct max30101_samples
+{
+    const uint32_t *red;
+    const uint32_t *ir;
+    const uint32_t *green;
+    const uint32_t *timestamp; // Microseconds of uptime, low 32 bits
+#ifdef CONFIG_APP_PPG_GAP_MARKERS
+    const uint8_t *gap; // Samples lost right before each one (saturates)
+#endif
+    uint16_t count;
+    int16_t configStart; // First sample under a new configuration (see
+                         // MAX30101::reconfigure()), -1 if none in this run
+};
+
+// Cumulative sample loss, see MAX30101::getLossStats()
+struct max30101_loss_stats
+{
+    uint32_t batches;         // FIFO reads that returned data
+    uint32_t overflowBatches; // Of those, reads with OVF_COUNTER > 0
+    uint32_t fifoLost;        // Samples lost in the sensor FIFO (reader too slow)
+    uint32_t ringLost;        // Samples dropped on a full ring (consumer too slow)
+};
+
+// Kinds of bus transfer, see MAX30101::getI2CStats()
+enum max30101_i2c_op
+{
+    MAX30101_I2C_READ,        // One register
+    MAX30101_I2C_WRITE,       // One register
+    MAX30101_I2C_BURST_READ,  // FIFO state and data, temperature
+    MAX30101_I2C_BURST_WRITE, // Configuration blocks, FIFO pointers
+    MAX30101_I2C_OPS,
+};
+
+// Latency buckets: under 16 us, then doubling up to 1024 us and over
+#define MAX30101_I2C_LATENCY_BUCKETS 8
+
+struct max30101_i2c_op_stats
+{
+    uint32_t transactions; // Attempts on the bus, retries included
+    uint32_t bytes;        // Payload, the register address not included
+    uint32_t errors;       // Attempts that failed
+    uint32_t retries;      // Attempts made again after an error
+    uint32_t busyUs;       // Time spent in the transfers
+    uint32_t maxUs;
+    uint32_t latency[MAX30101_I2C_LATENCY_BUCKETS];
+};
+
+// Bus use since begin() or resetI2CStats()
+struct max30101_i2c_stats
+{
+    struct max30101_i2c_op_stats op[MAX30101_I2C_OPS];
+    uint32_t avoided; // Register accesses served by the shadow cache
+};
+
 class MAX30101
 {
 public:
     MAX30101();
 
     bool begin(const struct device *dev);
+    bool begin(const struct i2c_dt_spec *i2c);
 
     uint32_t getRed(void);                  // Returns immediate red value
     uint32_t getIR(void);                   // Returns immediate IR value
@@ -88,6 +149,13 @@ public:
         uint8_t slotNumber,
         uint8_t device); // Given slot number, assign a device to slot
     void disableSlots(void);
+    void setupSlots(
+        const uint8_t *slots,
+        uint8_t count); // Assign slots 1..count and switch to multi-LED mode
+
+    // Compile-time channel layout, see MAX30101Storage.hpp
+    template <typename Storage> void setupSlots(void);
+    template <typename Storage> uint16_t check(Storage &storage);
 
     // Data Collection
 
@@ -111,27 +179,55 @@ public:
     void disableFIFORollover();
     void setFIFOAlmostFull(uint8_t samples);
 
+    // Interrupt-driven FIFO acquisition
+    bool beginInterrupt(
+        const struct gpio_dt_spec *intGpio,
+        struct k_sem *notify = nullptr); // Attach the (active low) INT pin
+    void enableFIFOInterrupt(
+        uint8_t samples); // Assert INT once 17 to 31 samples are unread
+    bool waitForFIFO(
+        k_timeout_t timeout); // Sleep until INT asserts, false on timeout
+
     // FIFO Reading
     uint16_t check(void);    // Checks for new data and fills FIFO
-    uint8_t available(void); // Tells caller how many new samples are
-                             // available (head - tail)
+    uint16_t startCheck(void); // Starts reading new data in the background
+    uint16_t finishCheck(
+        k_timeout_t timeout); // Waits for startCheck() and fills FIFO
+    uint16_t available(void); // Tells caller how many new samples are
+                              // available (head - tail)
     void nextSample(void);   // Advances the tail of the sense array
     uint32_t getFIFORed(
         void);                // Returns the FIFO sample pointed to by tail
     uint32_t getFIFOIR(void); // Returns the FIFO sample pointed to by tail
     uint32_t getFIFOGreen(
         void); // Returns the FIFO sample pointed to by tail
+    uint8_t getSamples(
+        struct max30101_samples runs[2]); // All unread samples, in 1 or 2 runs
+    void consumeSamples(uint16_t count);  // Advances the tail by count
+    uint32_t getRingOverruns(void); // Samples dropped on a full sense array
 
     uint8_t getWritePointer(void);
     uint8_t getReadPointer(void);
+    uint8_t getOverflowCounter(void); // OVF_COUNTER from the last check()
+    void getLossStats(struct max30101_loss_stats *stats);
+    float getSamplePeriod(void); // Measured against the MCU clock, in us
+    float getSampleRate(void);
+    float getClockDrift(void); // Sensor clock error, ppm
+    void resetLossStats(void);
     void clearFIFO(void); // Sets the read/write pointers to zero
 
     // Proximity Mode Interrupt Threshold
     void setPROXINTTHRESH(uint8_t val);
 
     // Die Temperature
-    float readTemperature();
+    float readTemperature(); // Blocks for a conversion (about 30 ms)
     float readTemperatureF();
+    bool startTemperature(void); // Start a conversion and return at once
+    bool pollTemperature(void);  // True once the conversion is done
+    void setTemperatureInterval(
+        uint32_t ms); // Convert every ms during FIFO reads, 0 = off
+    bool getTemperature(float *celsius); // Last conversion, false if none
+    uint32_t getTemperatureCount(void);  // Conversions since begin()
 
     // Detecting ID/Revision
     uint8_t getRevisionID();
@@ -155,6 +251,27 @@ public:
         uint8_t pulseWidth,
         uint8_t adcRange);
 
+    // Staged configuration: between beginConfig() and commitConfig() register
+    // writes only update the local image, commitConfig() then writes the
+    // changed registers with as few burst writes as possible
+    void beginConfig(void);
+    int commitConfig(void);
+
+    // Change the configuration of a streaming sensor: no reset, only changed
+    // registers are written and the FIFO keeps its samples. The first sample
+    // taken under the new configuration is flagged in max30101_samples.
+    int reconfigure(void); // Commits what was staged since beginConfig(),
+                           // -EINVAL if nothing is
+    int reconfigure(
+        uint8_t powerLevelRed,
+        uint8_t powerLevelIR,
+        uint8_t powerLevelGreen,
+        uint8_t sampleAverage,
+        uint8_t ledMode,
+        int sampleRate,
+        int pulseWidth,
+        int adcRange); // Same arguments as setup()
+
     // Get configuration registers.
     uint8_t getFIFOConfig();
     uint8_t getParticleConfig();
@@ -167,17 +284,57 @@ public:
     uint8_t readRegister8(uint8_t reg);
     void writeRegister8(uint8_t reg, uint8_t value);
 
-    uint8_t burstRead(uint8_t reg, uint16_t size);
+    int burstWrite(uint8_t reg, const uint8_t *data, uint8_t size);
+    uint16_t burstRead(uint8_t reg, uint16_t size);
     uint8_t burstRead_next();
 
+    uint32_t getI2CTransactionCount(); // Bus transactions since last reset
+    uint32_t getI2CTransactionsAvoided(); // Saved by the shadow cache
+    void resetI2CTransactionCount();
+    void getI2CStats(struct max30101_i2c_stats *stats);
+    void resetI2CStats(void);
+
 private:
-    const struct device *dev = nullptr;
+    const struct i2c_dt_spec *i2c = nullptr;
 
     static const uint16_t I2C_BUFFER_LENGTH = 288;
-    uint8_t burst_read_buffer[I2C_BUFFER_LENGTH];
+    BUILD_ASSERT(
+        I2C_BUFFER_LENGTH >= 32 * MAX3010x_MAX_NUM_CHANNELS * 3,
+        "startCheck() reads a full FIFO in one burst");
+    // Two buffers so a background FIFO read never lands in the buffer
+    // burstRead_next() is reading from
+    uint8_t burst_read_buffer[2][I2C_BUFFER_LENGTH];
+    uint8_t burst_read_active = 0;
     uint16_t burst_read_buffer_i = 0;
     uint16_t burst_read_buffer_used = 0;
 
+    struct max30101_i2c_stats i2cStats = {};
+    uint8_t overflowCounter = 0;
+    struct max30101_loss_stats loss = {};
+#ifdef CONFIG_APP_PPG_GAP_MARKERS
+    uint32_t pendingGap = 0; // Lost samples not yet attached to a gap marker
+#endif
+
+    // Sample timing, see max30101_timebase.h
+    struct max30101_timebase timebase = {};
+    int fifoLeftover = 0; // Samples left in the FIFO after the last read
+
+    float nominalSamplePeriod(void);
+    void updateTimebase(int64_t now, int pending);
+
+    // Die temperature conversion, see startTemperature()
+    struct temp_context
+    {
+        int64_t started;   // us, when the running conversion was started
+        int64_t next;      // us, when the next periodic conversion is due
+        uint32_t interval; // us, 0 when periodic conversion is off
+        bool pending;      // A conversion is running
+        atomic_t raw;      // Last reading, 1/16 degree C
+        atomic_t count;    // Readings since begin()
+    } temp = {};
+
+    void serviceTemperature(int64_t now);
+
     // activeLEDs is the number of channels turned on, and can be 1 to 3. 2
     // is common for Red+IR.
     uint8_t activeLEDs; // Gets set during setup. Allows check() to
@@ -188,17 +345,105 @@ private:
     void readRevisionID();
 
     void bitMask(uint8_t reg, uint8_t mask, uint8_t thing);
+    int readRegister(uint8_t reg, uint8_t *value);
+
+    // Every bus transfer goes through these, see getI2CStats()
+    template <typename Transfer>
+    int i2cRun(
+        enum max30101_i2c_op op, uint16_t bytes, int retries,
+        Transfer transfer);
+    void i2cRecord(
+        enum max30101_i2c_op op, uint16_t bytes, uint32_t cycles, int ret);
+
+    // Shadow copy of the configuration registers (0x02 - 0x12), so bitMask()
+    // does not need a read before every write. Bit n of shadowValid is set
+    // when shadow[n] matches the device. softReset() invalidates it.
+    static const uint8_t SHADOW_SIZE = 0x13;
+    uint8_t shadow[SHADOW_SIZE] = {};
+    uint32_t shadowValid = 0;
+    uint32_t shadowDirty = 0; // Staged but not yet written
+    uint8_t shadowBase[SHADOW_SIZE] = {}; // Value before the first staged
+    uint32_t shadowBaseValid = 0;         // write, to skip no-op changes
+    bool staging = false;
+    uint8_t previousLEDs = 0; // activeLEDs before beginConfig(), the layout
+                              // of the records already in the FIFO
+
+    static const uint8_t BURST_WRITE_MAX = 8;
+
+    static bool isShadowed(uint8_t reg);
+    uint8_t readShadow(uint8_t reg);
+
+    void stageSetup(
+        uint8_t powerLevelRed,
+        uint8_t powerLevelIR,
+        uint8_t powerLevelGreen,
+        uint8_t sampleAverage,
+        uint8_t ledMode,
+        int sampleRate,
+        int pulseWidth,
+        int adcRange);
+
+    // Configuration change marker, see reconfigure()
+    int configCountdown = -1; // FIFO records ahead of the first new one
+    atomic_t configMark;      // sense.head value of the first new sample
+    atomic_t configMarked;    // Number of markers placed
+
+    // INT pin state. Kept in its own struct so the GPIO callback can find it
+    // with CONTAINER_OF.
+    struct int_context
+    {
+        struct gpio_callback cb;
+        struct k_sem sem;
+        struct k_sem *notify;
+        const struct gpio_dt_spec *gpio;
+    } irq = {};
+
+    static void intHandler(
+        const struct device *port, struct gpio_callback *cb, uint32_t pins);
+
+    // Background FIFO read started by startCheck()
+    struct async_context
+    {
+        struct k_sem done;
+        struct i2c_msg msgs[2];
+        uint8_t reg;
+        int result;
+        uint8_t buffer; // Index of the burst_read_buffer being filled
+        uint16_t size;
+        uint32_t start; // Cycle count when the transfer was started
+        uint32_t end;   // and when it completed
+        bool busy;
+    } async = {};
+
+    static void asyncHandler(const struct device *bus, int result, void *data);
+
+    int readFIFOState(void);
+    int unpackSamples(int size);
+    const uint8_t *readFIFO(
+        uint8_t channels, int maxSamples, int *numberOfSamples);
+
+    // Lock-free single producer, single consumer ring, see MAX30101.cpp
+    static const int STORAGE_SIZE = CONFIG_APP_PPG_RING_DEPTH;
+    static const int STORAGE_MASK = STORAGE_SIZE - 1;
+    BUILD_ASSERT(
+        IS_POWER_OF_TWO(STORAGE_SIZE) && STORAGE_SIZE >= 32,
+        "PPG ring depth must be a power of 2 holding a full FIFO");
 
-    static const int STORAGE_SIZE = 32;
     typedef struct Record
     {
         uint32_t red[STORAGE_SIZE];
         uint32_t IR[STORAGE_SIZE];
         uint32_t green[STORAGE_SIZE];
-        uint8_t head;
-        uint8_t tail;
+        uint32_t timestamp[STORAGE_SIZE];
+#ifdef CONFIG_APP_PPG_GAP_MARKERS
+        uint8_t gap[STORAGE_SIZE];
+#endif
+        atomic_t head; // Samples written, only the producer stores it
+        atomic_t tail; // Samples consumed, only the consumer stores it
     } sense_struct; // This is our circular buffer of readings from the
                     // sensor
 
+    uint16_t newest(void);
+
     sense_struct sense;
 };
\ No newline at end of file
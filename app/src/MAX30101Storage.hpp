@@ -0,0 +1,128 @@
+/*
+    Compile-time sized sample storage for the MAX30101.
+
+    MAX30101Storage is parameterized on the multi-LED slot layout, so the
+    channel count is a constant: the FIFO decode is unrolled per record and
+    only the channels actually in use are stored. Use it with
+    MAX30101::setupSlots<Storage>() and MAX30101::check(Storage &) when the LED
+    layout is fixed at build time. The runtime configured getFIFO*() interface
+    of MAX30101 is unaffected.
+
+    Example, Red + IR:
+
+        using RedIR = MAX30101Storage<MAX3010x_SLOT_RED_LED1_PA,
+                                      MAX3010x_SLOT_IR_LED2_PA>;
+        RedIR samples;
+
+        ppg.setup(...);
+        ppg.setupSlots<RedIR>();
+        ppg.check(samples);
+        while (samples.available())
+        {
+            uint32_t ir = samples.get<MAX3010x_SLOT_IR_LED2_PA>();
+            ...
+            samples.nextSample();
+        }
+*/
+
+#pragma once
+
+#include "MAX30101.hpp"
+#include "max30101_fifo.h"
+
+template <enum max3010x_slot... Slots> class MAX30101Storage
+{
+public:
+    static constexpr uint8_t CHANNELS = sizeof...(Slots);
+    static constexpr uint8_t RECORD_SIZE = CHANNELS * MAX30101_FIFO_WORD_SIZE;
+    static constexpr uint8_t DEPTH = 32; // Power of two, matches the FIFO
+    static constexpr enum max3010x_slot SLOTS[CHANNELS] = {Slots...};
+
+    static_assert(CHANNELS >= 1 && CHANNELS <= MAX3010x_MAX_NUM_CHANNELS,
+                  "1 to 3 slots");
+    static_assert(((Slots >= MAX3010x_SLOT_RED_LED1_PA &&
+                    Slots <= MAX3010x_SLOT_GREEN_LED3_PA) && ...),
+                  "Only LED slots are supported");
+
+    // Channel index of a slot in the layout
+    template <enum max3010x_slot Slot> static constexpr uint8_t index()
+    {
+        for (uint8_t c = 0; c < CHANNELS; c++)
+            if (SLOTS[c] == Slot)
+                return c;
+        return CHANNELS;
+    }
+
+    uint8_t available(void) const { return head - tail; }
+    uint8_t space(void) const { return DEPTH - available(); }
+
+    // Sample at the tail for one slot
+    template <enum max3010x_slot Slot> uint32_t get(void) const
+    {
+        static_assert(index<Slot>() < CHANNELS, "Slot is not in the layout");
+        return data[index<Slot>()][tail & MASK];
+    }
+
+    uint32_t get(uint8_t channel) const { return data[channel][tail & MASK]; }
+
+    void nextSample(void)
+    {
+        if (available())
+            tail++;
+    }
+
+    // Append 'samples' FIFO records, the caller guarantees there is space
+    void push(const uint8_t *fifo, uint8_t samples)
+    {
+        for (uint8_t i = 0; i < samples; i++, fifo += RECORD_SIZE)
+        {
+            unpackRecord(fifo, (head + i) & MASK);
+        }
+        head += samples;
+    }
+
+private:
+    static constexpr uint8_t MASK = DEPTH - 1;
+
+    uint32_t data[CHANNELS][DEPTH] = {};
+    uint8_t head = 0; // Free running, wraps with uint8_t arithmetic
+    uint8_t tail = 0;
+
+    template <uint8_t C = 0>
+    void unpackRecord(const uint8_t *record, uint8_t i)
+    {
+        if constexpr (C < CHANNELS)
+        {
+            data[C][i] =
+                max30101_fifo_word(record + C * MAX30101_FIFO_WORD_SIZE);
+            unpackRecord<C + 1>(record, i);
+        }
+    }
+};
+
+// Program the multi-LED slots to match the storage layout
+template <typename Storage> void MAX30101::setupSlots(void)
+{
+    uint8_t slots[Storage::CHANNELS];
+
+    for (uint8_t c = 0; c < Storage::CHANNELS; c++)
+        slots[c] = Storage::SLOTS[c];
+
+    setupSlots(slots, Storage::CHANNELS);
+}
+
+// Checks for new data and fills 'storage', up to the space it has left
+// Returns number of new samples obtained
+template <typename Storage> uint16_t MAX30101::check(Storage &storage)
+{
+    int numberOfSamples;
+    const uint8_t *fifo =
+        readFIFO(Storage::CHANNELS, storage.space(), &numberOfSamples);
+
+    if (!fifo)
+        return (0);
+
+    storage.push(fifo, numberOfSamples);
+
+    return (numberOfSamples);
+}
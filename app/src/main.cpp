@@ -3,6 +3,8 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <stdarg.h>
+
 #include <zephyr/kernel.h>
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/logging/log.h>
@@ -22,14 +24,21 @@
 
 #include <zephyr/storage/disk_access.h>
 #include <zephyr/fs/fs.h>
+#include <zephyr/shell/shell.h>
 
 #include <ff.h>
 
 #include <app_version.h>
+#include <app/drivers/max30101_int.h>
 
 #include "MAX30101.hpp"
 
 #include "arm_math.h"
+#include "ppg_filter.h"
+#include "ppg_hr.h"
+#include "ppg_hr_fft.h"
+#include "ppg_motion.h"
+#include "ppg_spo2.h"
 
 bool is_use_display = false;
 bool is_use_ble = false;
@@ -37,9 +46,15 @@ bool is_use_sd = false;
 bool is_use_ppg = true;
 bool is_use_acc = true;
 
-uint8_t ledBrightnessRed = 0;	// Options: 0=Off to 255=50mA
-uint8_t ledBrightnessIR = 0;	// Options: 0=Off to 255=50mA
-uint8_t ledBrightnessGreen = 0; // Options: 0=Off to 255=50mA
+// Every enabled maxim,max30101 node gets its own driver object, in devicetree
+// instance order. Nodes behind an I2C mux are found the same way, their bus is
+// the mux channel.
+#define PPG_NUM DT_NUM_INST_STATUS_OKAY(maxim_max30101)
+BUILD_ASSERT(PPG_NUM > 0, "No maxim,max30101 node enabled");
+
+uint8_t ledBrightnessRed[PPG_NUM];	 // Options: 0=Off to 255=50mA
+uint8_t ledBrightnessIR[PPG_NUM];	 // Options: 0=Off to 255=50mA
+uint8_t ledBrightnessGreen[PPG_NUM]; // Options: 0=Off to 255=50mA
 
 #define PPG_STACK_SIZE 1024
 #define PPG_PRIORITY 5
@@ -47,56 +62,151 @@ uint8_t ledBrightnessGreen = 0; // Options: 0=Off to 255=50mA
 #define ACC_STACK_SIZE 1024
 #define ACC_PRIORITY 5
 
+#define PPG_PROC_STACK_SIZE 1024
+#define PPG_PROC_PRIORITY 6 // Below acquisition, so draining the FIFO never waits on processing
+
 #define FIFO_SAMPLES 32 // MAX30101 FIFO depth
+#define FIFO_WATERMARK 24 // Wake the PPG thread once this many samples are unread (17 - 31)
 static K_SEM_DEFINE(data_sem, 0, 1);
+static K_SEM_DEFINE(ppg_data_sem, 0, 1); // New samples in any MAX30101 ring
 static struct sensor_value acc_data[3]; // Shared accelerometer data
 static bool new_acc_data = false;
 
+#ifdef CONFIG_APP_PPG_MOTION
+// Accelerometer samples with their time, pushed by acc_entry_point on its own
+// clock and looked up by the process thread at the time of each PPG sample
+static struct ppg_motion_ring acc_ring;
+static struct k_spinlock acc_ring_lock;
+static K_TIMER_DEFINE(acc_timer, NULL, NULL);
+#endif
+
 extern void ppg_entry_point(void *, void *, void *);
 
 K_THREAD_DEFINE(ppg_tid, ACC_STACK_SIZE,
 				ppg_entry_point, NULL, NULL, NULL,
 				ACC_PRIORITY, 0, 0);
 
+// One acquisition thread per physical I2C bus, started by ppg_entry_point.
+// Sensors on the same bus are read back to back, other buses in parallel.
+extern void ppg_bus_entry_point(void *, void *, void *);
+
+static K_THREAD_STACK_ARRAY_DEFINE(ppg_bus_stacks, PPG_NUM, PPG_STACK_SIZE);
+static struct k_thread ppg_bus_threads[PPG_NUM];
+
+struct ppg_bus_group
+{
+	const struct device *bus;
+	uint8_t sensors[PPG_NUM]; // Indexes into ppg_sensors
+	uint8_t count;
+	struct k_sem irq; // Given by the INT line of any sensor on the bus
+};
+
+static struct ppg_bus_group ppg_groups[PPG_NUM];
+
+extern void ppg_process_entry_point(void *, void *, void *);
+
+K_THREAD_DEFINE(ppg_proc_tid, PPG_PROC_STACK_SIZE,
+				ppg_process_entry_point, NULL, NULL, NULL,
+				PPG_PROC_PRIORITY, 0, 0);
+
 extern void acc_entry_point(void *, void *, void *);
 
 K_THREAD_DEFINE(acc_tid, PPG_STACK_SIZE,
 				acc_entry_point, NULL, NULL, NULL,
 				PPG_PRIORITY, 0, 0);
 
-#define IIR_ORDER 2
-#define IIR_NUMSTAGES (IIR_ORDER / 2)
+#if defined(CONFIG_APP_PPG_FILTER_Q31) || defined(CONFIG_APP_PPG_FILTER_Q15)
+BUILD_ASSERT(PPG_IIR_FIXED_POINT_SAFE,
+			 "a filter in dsp/ppg_filters.yaml can overflow the fixed point pipeline");
+#endif
+
+// Output data rate of each sensor, picks its coefficient table
+static float32_t ppg_rate[PPG_NUM];
+
+// Filter output of the run being printed is kept in ppg_filtered. A run never
+// holds more than the sample ring, and one process thread serves all sensors.
+#if defined(CONFIG_APP_PPG_FILTER_Q31)
+// One CMSIS instance per channel, ADC counts in and out without float
+static q31_t m_biquad_state[PPG_NUM][3][4 * PPG_IIR_NUMSTAGES];
+static arm_biquad_casd_df1_inst_q31 ppg_iir[PPG_NUM][3];
+static q31_t ppg_filtered[3][CONFIG_APP_PPG_RING_DEPTH];
+#define PPG_FILTER_COUNTS ppg_filter_counts_q31
+#elif defined(CONFIG_APP_PPG_FILTER_Q15)
+static q15_t m_biquad_state[PPG_NUM][3][4 * PPG_IIR_NUMSTAGES];
+static arm_biquad_casd_df1_inst_q15 ppg_iir[PPG_NUM][3];
+static q15_t ppg_filtered[3][CONFIG_APP_PPG_RING_DEPTH];
+#define PPG_FILTER_COUNTS ppg_filter_counts_q15
+#else
+static float32_t m_biquad_state[PPG_NUM][PPG_FILTER_BANK_SIZE(3)];
+
+// Red, IR and green filtered in lockstep, one bank per sensor
+static struct ppg_filter_bank ppg_filters[PPG_NUM];
+static float32_t ppg_filtered[3][CONFIG_APP_PPG_RING_DEPTH];
+#endif
+
+#if defined(CONFIG_APP_PPG_HR) || defined(CONFIG_APP_PPG_HR_SPECTRAL)
+#define PPG_HR_CHANNEL (IS_ENABLED(CONFIG_APP_PPG_HR_GREEN) ? 2 : 1)
+#endif
+
+#ifdef CONFIG_APP_PPG_HR
+// One beat detector per sensor, on its IR or green channel
+static struct ppg_hr ppg_beats[PPG_NUM];
+#endif
+
+#ifdef CONFIG_APP_PPG_MOTION
+// One canceller per sensor, for its three channels
+static struct ppg_motion ppg_motions[PPG_NUM];
+#endif
+
+#ifdef CONFIG_APP_PPG_HR_SPECTRAL
+// One spectral estimator per sensor, on the same channel. Updates run one at
+// a time on the process thread, so they share the scratch.
+static struct ppg_hr_fft ppg_spectra[PPG_NUM];
+static float32_t ppg_hr_fft_scratch[PPG_HR_FFT_SCRATCH];
+#endif
+
+#ifdef CONFIG_APP_PPG_SPO2
+// Windowed on the beats of ppg_beats
+static struct ppg_spo2 ppg_spo2s[PPG_NUM];
+static const struct ppg_spo2_cal ppg_spo2_cal = {
+#ifdef CONFIG_APP_PPG_SPO2_CAL
+	CONFIG_APP_PPG_SPO2_CAL_A / 1000.0f,
+	CONFIG_APP_PPG_SPO2_CAL_B / 1000.0f,
+	CONFIG_APP_PPG_SPO2_CAL_C / 1000.0f,
+#else
+	PPG_SPO2_CAL_A,
+	PPG_SPO2_CAL_B,
+	PPG_SPO2_CAL_C,
+#endif
+};
+#endif
 
-static float32_t m_biquad_red_state[IIR_ORDER];
-static float32_t m_biquad_ir_state[IIR_ORDER];
-static float32_t m_biquad_green_state[IIR_ORDER];
-static float32_t m_biquad_coeffs[5 * IIR_NUMSTAGES] =
-	{
-		0.274727,
-		0.549454,
-		0.274727,
-		0.073624,
-	   -0.172531};
+#define PPG_NODE(i) DT_INST(i, maxim_max30101)
 
-arm_biquad_cascade_df2T_instance_f32 const red_iir_inst =
-	{
-		IIR_ORDER / 2,
-		m_biquad_red_state,
-		m_biquad_coeffs};
+// Physical bus of a sensor. Behind a mux channel that is the mux's own bus, so
+// sensors on different channels of one mux share a thread.
+#define PPG_ROOT_BUS(node)                                   \
+	COND_CODE_1(DT_ON_BUS(DT_PARENT(DT_BUS(node)), i2c),     \
+				(DT_BUS(DT_PARENT(DT_BUS(node)))), (DT_BUS(node)))
 
-arm_biquad_cascade_df2T_instance_f32 const ir_iir_inst =
-	{
-		IIR_ORDER / 2,
-		m_biquad_ir_state,
-		m_biquad_coeffs};
+#define PPG_I2C(i, _) I2C_DT_SPEC_GET(PPG_NODE(i))
+#define PPG_BUS(i, _) DEVICE_DT_GET(PPG_ROOT_BUS(PPG_NODE(i)))
+// MAX30101 INT lines, optional, matched to their sensor by ppg-int-sensors in
+// zephyr,user. A sensor without one is polled.
+#define PPG_INT(i, _) MAX30101_INT_GPIO_DT_SPEC_GET_OR(PPG_NODE(i), {0})
 
-arm_biquad_cascade_df2T_instance_f32 const green_iir_inst =
-	{
-		IIR_ORDER / 2,
-		m_biquad_green_state,
-		m_biquad_coeffs};
+#if DT_NODE_HAS_PROP(DT_PATH(zephyr_user), ppg_int_gpios)
+BUILD_ASSERT(DT_PROP_LEN(DT_PATH(zephyr_user), ppg_int_gpios) ==
+				 DT_PROP_LEN_OR(DT_PATH(zephyr_user), ppg_int_sensors, 0),
+			 "every ppg-int-gpios entry needs its sensor in ppg-int-sensors");
+#endif
 
-MAX30101 ppg = MAX30101();
+static const struct i2c_dt_spec ppg_i2c[PPG_NUM] = {LISTIFY(PPG_NUM, PPG_I2C, (, ))};
+static const struct device *const ppg_bus[PPG_NUM] = {LISTIFY(PPG_NUM, PPG_BUS, (, ))};
+static const struct gpio_dt_spec ppg_int[PPG_NUM] = {LISTIFY(PPG_NUM, PPG_INT, (, ))};
+
+static MAX30101 ppg_sensors[PPG_NUM];
+static bool ppg_ready[PPG_NUM];
 
 LOG_MODULE_REGISTER(main, CONFIG_APP_LOG_LEVEL);
 
@@ -132,7 +242,7 @@ static const struct gpio_dt_spec led0 = GPIO_DT_SPEC_GET(DT_ALIAS(led0), gpios);
 static const struct gpio_dt_spec led1 = GPIO_DT_SPEC_GET(DT_ALIAS(led1), gpios);
 static const struct gpio_dt_spec led2 = GPIO_DT_SPEC_GET(DT_ALIAS(led1), gpios);
 
-const struct device *display_dev, *max30101_dev, *adxl_dev;
+const struct device *display_dev, *adxl_dev;
 
 static struct bt_conn *current_conn;
 
@@ -520,9 +630,11 @@ int main(void)
 	return 0;
 }
 
-void calbrate_ppg(void)
+void calbrate_ppg(uint8_t n)
 {
-	LOG_INF("Calibrating PPG sensor...");
+	MAX30101 &ppg = ppg_sensors[n];
+
+	LOG_INF("Calibrating PPG sensor %u...", n);
 	// Initial setup with low brightness values
 	uint8_t templedBrightnessRed = 0;
 	uint8_t templedBrightnessIR = 0;
@@ -537,6 +649,7 @@ void calbrate_ppg(void)
 	const uint32_t TARGET_DC = 262144 / 2; // Target DC level
 	const uint32_t TOLERANCE = 4096;	   // Tolerance range
 	bool is_calibrating = true;
+	bool settled = true; // No LED change waiting for its first sample
 	int stable_count = 0;
 
 	ppg.setup(templedBrightnessRed, templedBrightnessIR, templedBrightnessGreen,
@@ -546,152 +659,835 @@ void calbrate_ppg(void)
 	{
 		ppg.check();
 
-		while (ppg.available())
+		// Step the LEDs once per batch based on the mean of the samples taken
+		// at the current LED setting, i.e. from the reconfiguration marker on
+		struct max30101_samples runs[2];
+		uint8_t runCount = ppg.getSamples(runs);
+		uint16_t count = 0;
+		uint16_t used = 0;
+		uint64_t sumRed = 0;
+		uint64_t sumIR = 0;
+		uint64_t sumGreen = 0;
+
+		for (uint8_t r = 0; r < runCount; r++)
 		{
-			uint32_t red = ppg.getFIFORed();
-			uint32_t ir = ppg.getFIFOIR();
-			uint32_t green = ppg.getFIFOGreen();
-
-			// Adjust RED LED
-			if (red > TARGET_DC + TOLERANCE)
+			for (uint16_t i = 0; i < runs[r].count; i++)
 			{
-				templedBrightnessRed = MAX(0, templedBrightnessRed - 1);
+				if (i == runs[r].configStart)
+				{
+					settled = true;
+					used = 0;
+					sumRed = sumIR = sumGreen = 0;
+				}
+				sumRed += runs[r].red[i];
+				sumIR += runs[r].ir[i];
+				sumGreen += runs[r].green[i];
+				used++;
 			}
-			else if (red < TARGET_DC - TOLERANCE)
+			count += runs[r].count;
+		}
+
+		ppg.consumeSamples(count);
+
+		if (!settled || used == 0)
+		{
+			continue;
+		}
+
+		count = used;
+
+		uint32_t red = sumRed / count;
+		uint32_t ir = sumIR / count;
+		uint32_t green = sumGreen / count;
+
+		// Adjust RED LED
+		if (red > TARGET_DC + TOLERANCE)
+		{
+			templedBrightnessRed = MAX(0, templedBrightnessRed - 1);
+		}
+		else if (red < TARGET_DC - TOLERANCE)
+		{
+			templedBrightnessRed = MIN(255, templedBrightnessRed + 1);
+		}
+
+		// Adjust IR LED
+		if (ir > TARGET_DC + TOLERANCE)
+		{
+			templedBrightnessIR = MAX(0, templedBrightnessIR - 1);
+		}
+		else if (ir < TARGET_DC - TOLERANCE)
+		{
+			templedBrightnessIR = MIN(255, templedBrightnessIR + 1);
+		}
+
+		// // Adjust GREEN LED
+		// if (green > TARGET_DC + TOLERANCE) {
+		//     templedBrightnessGreen = MAX(0, templedBrightnessGreen - 1);
+		// } else if (green < TARGET_DC - TOLERANCE) {
+		//     templedBrightnessGreen = MIN(255, templedBrightnessGreen + 1);
+		// }
+
+		templedBrightnessGreen = 255;
+		// Update LED brightness, the changed LED PA registers go out as one
+		// burst write and the FIFO keeps running
+		ppg.beginConfig();
+		ppg.setPulseAmplitudeRed(templedBrightnessRed);
+		ppg.setPulseAmplitudeIR(templedBrightnessIR);
+		ppg.setPulseAmplitudeGreen(templedBrightnessGreen);
+		ppg.reconfigure();
+		settled = false;
+
+		// Print current values
+		printk("R:%d(%d),IR:%d(%d),G:%d(%d)\n",
+			   templedBrightnessRed, red,
+			   templedBrightnessIR, ir,
+			   templedBrightnessGreen, green);
+
+		// Check if all LEDs are within tolerance
+		if (abs((int32_t)(red - TARGET_DC)) < (int32_t)TOLERANCE &&
+			abs((int32_t)(ir - TARGET_DC)) < (int32_t)TOLERANCE)
+		{
+			is_calibrating = false;
+			ledBrightnessRed[n] = templedBrightnessRed;
+			ledBrightnessIR[n] = templedBrightnessIR;
+			ledBrightnessGreen[n] = templedBrightnessGreen;
+		}
+		// k_sleep(K_MSEC(10));  // Prevent tight loop
+	}
+
+	LOG_INF("Calibration %u complete - R:%d, IR:%d, G:%d\n", n,
+			ledBrightnessRed[n], ledBrightnessIR[n], ledBrightnessGreen[n]);
+}
+
+// Identify and calibrate one sensor, which leaves it running at the
+// calibration rate. Returns whether it answered.
+static bool ppg_begin(uint8_t n)
+{
+	MAX30101 &ppg = ppg_sensors[n];
+
+	if (!ppg.begin(&ppg_i2c[n]))
+	{
+		LOG_ERR("Could not begin PPG device %u...", n);
+		return false;
+	}
+
+	// Setup to sense up to 18 inches, max LED brightness
+
+	calbrate_ppg(n);
+
+	return true;
+}
+
+// Configure a calibrated sensor for streaming and attach its INT line to the
+// bus semaphore. Returns 1 if it raises INT, 0 if it has to be polled, or
+// -ENOTSUP if there are no filter coefficients for its rate.
+static int ppg_start(uint8_t n, struct k_sem *irq)
+{
+	MAX30101 &ppg = ppg_sensors[n];
+
+	uint8_t sampleAverage = 2; // Options: 1, 2, 4, 8, 16, 32
+	uint8_t ledMode = 3;	   // Options: 1 = Red only, 2 = Red + IR, 3 = Red + IR + Green
+	int sampleRate = 100;	   // Options: 50, 100, 200, 400, 800, 1000, 1600, 3200
+	int pulseWidth = 215;	   // Options: 69, 118, 215, 411
+	int adcRange = 16384;	   // Options: 2048, 4096, 8192, 16384
+
+	float32_t rate = (float32_t)sampleRate / sampleAverage;
+
+	if (ppg_filter_select(rate) < 0)
+	{
+		LOG_ERR("PPG %u no filter for %.2f Hz, add the rate to dsp/ppg_filters.yaml", n,
+				(double)rate);
+		ppg.shutDown();
+		return -ENOTSUP;
+	}
+
+	// Set before the change goes out: the process thread resets the filters
+	// at its marker and picks their coefficients for this rate
+	ppg_rate[n] = rate;
+
+	// Calibration left the sensor running, only change what differs
+	ppg.reconfigure(ledBrightnessRed[n], ledBrightnessIR[n], ledBrightnessGreen[n], sampleAverage, ledMode, sampleRate, pulseWidth, adcRange);
+
+	// The FIFO overflowed while the other sensors on the bus calibrated,
+	// those samples are of no use and not a loss
+	ppg.clearFIFO();
+	ppg.resetLossStats();
+
+	bool use_int = ppg_int[n].port != NULL && ppg.beginInterrupt(&ppg_int[n], irq);
+
+	if (use_int)
+	{
+		ppg.enableFIFOInterrupt(FIFO_WATERMARK);
+		LOG_INF("PPG %u interrupt mode, watermark %d samples", n, FIFO_WATERMARK);
+	}
+
+	// After setup() in calibration, which resets the interrupt enables
+	ppg.setTemperatureInterval(CONFIG_APP_PPG_TEMP_INTERVAL_MS);
+
+	// Calibration has been using the ring, only now may the processing thread
+	ppg_ready[n] = true;
+
+	return use_int ? 1 : 0;
+}
+
+// Group the sensors by physical bus and start one acquisition thread per bus
+void ppg_entry_point(void *a, void *b, void *c)
+{
+	uint8_t groups = 0;
+
+	for (uint8_t n = 0; n < PPG_NUM; n++)
+	{
+		uint8_t g = 0;
+
+		while (g < groups && ppg_groups[g].bus != ppg_bus[n])
+		{
+			g++;
+		}
+
+		if (g == groups)
+		{
+			ppg_groups[g].bus = ppg_bus[n];
+			k_sem_init(&ppg_groups[g].irq, 0, 1);
+			groups++;
+		}
+
+		ppg_groups[g].sensors[ppg_groups[g].count++] = n;
+	}
+
+	for (uint8_t g = 0; g < groups; g++)
+	{
+		LOG_INF("PPG bus %s: %u sensor(s)", ppg_groups[g].bus->name, ppg_groups[g].count);
+
+		k_tid_t tid = k_thread_create(&ppg_bus_threads[g], ppg_bus_stacks[g],
+									  K_THREAD_STACK_SIZEOF(ppg_bus_stacks[g]),
+									  ppg_bus_entry_point, &ppg_groups[g], NULL, NULL,
+									  PPG_PRIORITY, 0, K_NO_WAIT);
+		k_thread_name_set(tid, "ppg_bus");
+	}
+}
+
+void ppg_bus_entry_point(void *a, void *b, void *c)
+{
+	struct ppg_bus_group *group = (struct ppg_bus_group *)a;
+	uint8_t started = 0;
+	uint8_t streaming = 0;
+	uint8_t interrupts = 0;
+	float32_t fastest = 0;
+
+	// Calibrate every sensor first, then start them back to back, so none
+	// streams unread while another one calibrates. Only the sensors that
+	// answered stay in the group.
+	for (uint8_t s = 0; s < group->count; s++)
+	{
+		if (ppg_begin(group->sensors[s]))
+		{
+			group->sensors[started++] = group->sensors[s];
+		}
+	}
+	group->count = started;
+
+	if (started == 0)
+	{
+		LOG_ERR("No PPG sensor on bus %s", group->bus->name);
+		return;
+	}
+
+	// Likewise only the sensors that stream
+	for (uint8_t s = 0; s < group->count; s++)
+	{
+		uint8_t n = group->sensors[s];
+		int rc = ppg_start(n, &group->irq);
+
+		if (rc < 0)
+		{
+			continue;
+		}
+		group->sensors[streaming++] = n;
+		interrupts += rc;
+		fastest = MAX(fastest, ppg_rate[n]);
+	}
+	group->count = streaming;
+
+	if (streaming == 0)
+	{
+		return;
+	}
+
+	// Sleep until a FIFO reaches the watermark and drain it in one go. Should
+	// an edge be missed, the timeout drains every FIFO anyway, halfway
+	// between the watermark and full so nothing overflows. Unless every
+	// sensor on the bus has an INT line, poll twice per batch period instead.
+	// Both go by the fastest sensor on the bus.
+	bool use_int = interrupts == group->count;
+	int batch_ms = (int)(1000 * FIFO_WATERMARK / fastest);
+	int timeout_ms = MAX((int)(1000 * (FIFO_WATERMARK + FIFO_SAMPLES) / 2 / fastest), 1);
+
+	// Acquisition only: samples go into the driver's lock-free ring and are
+	// processed by ppg_process_entry_point
+	while (1)
+	{
+		bool woken = false;
+
+		if (use_int)
+		{
+			woken = k_sem_take(&group->irq, K_MSEC(timeout_ms)) == 0;
+		}
+		else
+		{
+			k_sleep(K_MSEC(batch_ms / 2));
+		}
+
+		for (uint8_t s = 0; s < group->count; s++)
+		{
+			uint8_t n = group->sensors[s];
+			MAX30101 &ppg = ppg_sensors[n];
+
+			if (!ppg_ready[n])
 			{
-				templedBrightnessRed = MIN(255, templedBrightnessRed + 1);
+				continue;
 			}
 
-			// Adjust IR LED
-			if (ir > TARGET_DC + TOLERANCE)
+			// Acknowledges the interrupt before the drain, also after a
+			// timeout, where INT may be stuck low from a missed edge
+			bool raised = ppg.waitForFIFO(K_NO_WAIT);
+
+			// Only the sensors that raised INT, unless we timed out
+			if (woken && !raised)
 			{
-				templedBrightnessIR = MAX(0, templedBrightnessIR - 1);
+				continue;
 			}
-			else if (ir < TARGET_DC - TOLERANCE)
+
+			// The thread sleeps while the burst is on the bus
+			ppg.startCheck();
+			if (ppg.finishCheck(K_FOREVER) > 0)
 			{
-				templedBrightnessIR = MIN(255, templedBrightnessIR + 1);
+				k_sem_give(&ppg_data_sem);
 			}
 
-			// // Adjust GREEN LED
-			// if (green > TARGET_DC + TOLERANCE) {
-			//     templedBrightnessGreen = MAX(0, templedBrightnessGreen - 1);
-			// } else if (green < TARGET_DC - TOLERANCE) {
-			//     templedBrightnessGreen = MIN(255, templedBrightnessGreen + 1);
-			// }
-
-			templedBrightnessGreen = 255;
-			// Update LED brightness
-			ppg.setPulseAmplitudeRed(templedBrightnessRed);
-			ppg.setPulseAmplitudeIR(templedBrightnessIR);
-			ppg.setPulseAmplitudeGreen(templedBrightnessGreen);
-
-			// Print current values
-			printk("R:%d(%d),IR:%d(%d),G:%d(%d)\n",
-				   templedBrightnessRed, red,
-				   templedBrightnessIR, ir,
-				   templedBrightnessGreen, green);
-
-			// Check if all LEDs are within tolerance
-			if (abs(red - TARGET_DC) < TOLERANCE &&
-				abs(ir - TARGET_DC) < TOLERANCE)
+			// Samples the sensor FIFO dropped before this batch (saturates at 31)
+			if (ppg.getOverflowCounter() > 0)
 			{
-				is_calibrating = false;
-				ledBrightnessRed = templedBrightnessRed;
-				ledBrightnessIR = templedBrightnessIR;
-				ledBrightnessGreen = templedBrightnessGreen;
-				break;
+				struct max30101_loss_stats loss;
+
+				ppg.getLossStats(&loss);
+				LOG_WRN("PPG %u FIFO overflow, %u samples lost (%u in %u/%u batches)",
+						n, ppg.getOverflowCounter(), loss.fifoLost,
+						loss.overflowBatches, loss.batches);
 			}
-			ppg.nextSample();
 		}
-		// k_sleep(K_MSEC(10));  // Prevent tight loop
 	}
+}
+
+// Start sensor n's filters over from rest, with the coefficients for its
+// current output data rate
+static void ppg_filter_reset(uint8_t n)
+{
+	int table = ppg_filter_select(ppg_rate[n]);
 
-	LOG_INF("Calibration complete - R:%d, IR:%d, G:%d\n",
-			ledBrightnessRed, ledBrightnessIR, ledBrightnessGreen);
+	// Only before the sensor has a rate: ppg_start() doesn't stream at a
+	// rate without a table
+	if (table < 0)
+	{
+		table = 0;
+	}
+	else if (ppg_iir_rates[table] != ppg_rate[n])
+	{
+		LOG_WRN("PPG %u no filter for %.2f Hz, using the %.2f Hz one", n,
+				(double)ppg_rate[n], (double)ppg_iir_rates[table]);
+	}
+
+#if defined(CONFIG_APP_PPG_FILTER_Q31)
+	for (uint8_t ch = 0; ch < 3; ch++)
+	{
+		ppg_filter_init_q31(&ppg_iir[n][ch], m_biquad_state[n][ch], table);
+	}
+#elif defined(CONFIG_APP_PPG_FILTER_Q15)
+	for (uint8_t ch = 0; ch < 3; ch++)
+	{
+		ppg_filter_init_q15(&ppg_iir[n][ch], m_biquad_state[n][ch], table);
+	}
+#else
+	ppg_filter_bank_init(&ppg_filters[n], 3, m_biquad_state[n], table);
+#endif
+
+#if defined(CONFIG_APP_PPG_HR) || defined(CONFIG_APP_PPG_HR_SPECTRAL) || \
+	defined(CONFIG_APP_PPG_MOTION)
+	// Before the sensor has a rate, the filters run at the table's
+	float fs = ppg_rate[n] > 0 ? ppg_rate[n] : ppg_iir_rates[table];
+#endif
+#ifdef CONFIG_APP_PPG_MOTION
+	ppg_motion_reset(&ppg_motions[n], fs, CONFIG_APP_PPG_MOTION_MU / 1000.0f);
+#endif
+#ifdef CONFIG_APP_PPG_HR
+	ppg_hr_reset(&ppg_beats[n], fs);
+#endif
+#ifdef CONFIG_APP_PPG_SPO2
+	ppg_spo2_reset(&ppg_spo2s[n], fs, &ppg_spo2_cal);
+#endif
+#ifdef CONFIG_APP_PPG_HR_SPECTRAL
+	if (ppg_hr_fft_init(&ppg_spectra[n], fs) != ARM_MATH_SUCCESS)
+	{
+		LOG_ERR("PPG %u spectral heart rate init failed", n);
+	}
+#endif
 }
 
-void ppg_entry_point(void *a, void *b, void *c)
+// Filter samples first .. first + count - 1 of a run into the same place in
+// ppg_filtered
+static void ppg_filter_run(uint8_t n, const uint32_t *const raw[3], uint16_t first, uint16_t count)
+{
+#if defined(CONFIG_APP_PPG_FILTER_Q31)
+	for (uint8_t ch = 0; ch < 3; ch++)
+	{
+		ppg_filter_block_q31(&ppg_iir[n][ch], raw[ch] + first, ppg_filtered[ch] + first, count);
+	}
+#elif defined(CONFIG_APP_PPG_FILTER_Q15)
+	for (uint8_t ch = 0; ch < 3; ch++)
+	{
+		ppg_filter_block_q15(&ppg_iir[n][ch], raw[ch] + first, ppg_filtered[ch] + first, count);
+	}
+#else
+	const uint32_t *const in[3] = {raw[0] + first, raw[1] + first, raw[2] + first};
+	float32_t *const out[3] = {ppg_filtered[0] + first, ppg_filtered[1] + first,
+							   ppg_filtered[2] + first};
+
+	ppg_filter_bank_run(&ppg_filters[n], in, out, count);
+#endif
+}
+
+// Lines of the process thread collect here and go out with one printk per
+// batch instead of one per line, each printk being a log message of its own
+// with CONFIG_LOG_PRINTK. Below the log buffer, so a batch is never dropped.
+#define PPG_OUT_SIZE 256
+#define PPG_OUT_LINE 80 // Longest line, with room to spare
+static char ppg_out_buf[PPG_OUT_SIZE];
+static size_t ppg_out_len;
+
+static void ppg_out_flush(void)
 {
-	max30101_dev = DEVICE_DT_GET_ANY(maxim_max30101);
+	if (ppg_out_len > 0)
+	{
+		printk("%s", ppg_out_buf);
+		ppg_out_len = 0;
+	}
+}
 
-	if (!device_is_ready(max30101_dev))
+// printk() into the batch
+static void ppg_out(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (PPG_OUT_SIZE - ppg_out_len < PPG_OUT_LINE)
 	{
-		LOG_ERR("max30101 device is not ready\n");
+		ppg_out_flush();
 	}
 
-	if (!ppg.begin(max30101_dev))
+	va_start(ap, fmt);
+	int len = vsnprintk(&ppg_out_buf[ppg_out_len], PPG_OUT_SIZE - ppg_out_len, fmt, ap);
+	va_end(ap);
+
+	if (len > 0)
 	{
-		LOG_ERR("Could not begin PPG device...");
+		ppg_out_len = MIN(ppg_out_len + len, PPG_OUT_SIZE - 1);
 	}
+}
 
-	// Setup to sense up to 18 inches, max LED brightness
+// Print sample i of the run of sensor n. With several sensors, S: tells the
+// recorder which one.
+static void ppg_print(uint8_t n, uint32_t taken, uint16_t i)
+{
+#ifdef PPG_FILTER_COUNTS
+	// Whole ADC counts, no float formatting
+	int32_t red = PPG_FILTER_COUNTS(ppg_filtered[0][i]);
+	int32_t ir = PPG_FILTER_COUNTS(ppg_filtered[1][i]);
+	int32_t green = PPG_FILTER_COUNTS(ppg_filtered[2][i]);
+
+	if (PPG_NUM > 1)
+	{
+		ppg_out("S:%u,C:%d,R:%d,IR:%d,G:%d\n", n, taken, red, ir, green);
+	}
+	else
+	{
+		ppg_out("C:%d,R:%d,IR:%d,G:%d\n", taken, red, ir, green);
+	}
+#else
+	if (PPG_NUM > 1)
+	{
+		ppg_out("S:%u,C:%d,R:%.1f,IR:%.1f,G:%.1f\n",
+				n, taken, ppg_filtered[0][i], ppg_filtered[1][i], ppg_filtered[2][i]);
+	}
+	else
+	{
+		ppg_out("C:%d,R:%.1f,IR:%.1f,G:%.1f\n",
+				taken, ppg_filtered[0][i], ppg_filtered[1][i], ppg_filtered[2][i]);
+	}
+#endif
+}
 
-	calbrate_ppg();
+#ifdef CONFIG_APP_PPG_MOTION
+// Take the motion out of sample i of the run of sensor n, in ppg_filtered,
+// with the acceleration (m/s^2) at 'at', the sample's time, into acc[].
+// Without an accelerometer sample around that time the sample is left as it
+// is and acc[] is 0. Returns whether there was one.
+static bool ppg_motion_feed(uint8_t n, uint32_t at, uint16_t i, float acc[PPG_MOTION_AXES])
+{
+	k_spinlock_key_t key = k_spin_lock(&acc_ring_lock);
+	bool found = ppg_motion_ring_at(&acc_ring, at, acc);
 
-	uint8_t sampleAverage = 2; // Options: 1, 2, 4, 8, 16, 32
-	uint8_t ledMode = 3;	   // Options: 1 = Red only, 2 = Red + IR, 3 = Red + IR + Green
-	int sampleRate = 100;	   // Options: 50, 100, 200, 400, 800, 1000, 1600, 3200
-	int pulseWidth = 215;	   // Options: 69, 118, 215, 411
-	int adcRange = 16384;	   // Options: 2048, 4096, 8192, 16384
+	k_spin_unlock(&acc_ring_lock, key);
+
+	if (!found)
+	{
+		for (uint8_t a = 0; a < PPG_MOTION_AXES; a++)
+		{
+			acc[a] = 0.0f;
+		}
+		return false;
+	}
+
+	float x[PPG_MOTION_CHANNELS] = {ppg_filtered[0][i], ppg_filtered[1][i], ppg_filtered[2][i]};
+
+	ppg_motion_update(&ppg_motions[n], acc, x);
+	for (uint8_t ch = 0; ch < PPG_MOTION_CHANNELS; ch++)
+	{
+		ppg_filtered[ch][i] = x[ch];
+	}
+
+	return true;
+}
+
+// Print the acceleration at a sample in whole mg, the line the recorder pairs
+// with the sample's
+static void ppg_motion_print(uint8_t n, const float acc[PPG_MOTION_AXES])
+{
+	int x = (int)lroundf(acc[0] * 1e9f / SENSOR_G);
+	int y = (int)lroundf(acc[1] * 1e9f / SENSOR_G);
+	int z = (int)lroundf(acc[2] * 1e9f / SENSOR_G);
+
+	if (PPG_NUM > 1)
+	{
+		ppg_out("S:%u,X:%d,Y:%d,Z:%d\n", n, x, y, z);
+	}
+	else
+	{
+		ppg_out("X:%d,Y:%d,Z:%d\n", x, y, z);
+	}
+}
+#endif
+
+#if defined(CONFIG_APP_PPG_HR) || defined(CONFIG_APP_PPG_HR_SPECTRAL)
+// Filter output of channel ch, sample i of the run, in ADC counts
+static float ppg_filtered_counts(uint8_t ch, uint16_t i)
+{
+#ifdef PPG_FILTER_COUNTS
+	return (float)PPG_FILTER_COUNTS(ppg_filtered[ch][i]);
+#else
+	return ppg_filtered[ch][i];
+#endif
+}
+#endif
+
+#ifdef CONFIG_APP_PPG_HR
+// Feed sample i of the run of sensor n to its beat detector, and print the
+// interval (ms) and the average rate (bpm) at each beat. The interval is 0
+// when there is no usable one, after a gap or a missed or extra beat.
+// Returns whether there was a beat.
+static bool ppg_hr_feed(uint8_t n, uint16_t i)
+{
+	struct ppg_hr_beat beat;
+
+	if (!ppg_hr_update(&ppg_beats[n], ppg_filtered_counts(PPG_HR_CHANNEL, i), &beat))
+	{
+		return false;
+	}
+
+	// Whole numbers, no float formatting
+	int interval = (int)(beat.intervalMs + 0.5f);
+	int bpm = (int)(beat.bpm + 0.5f);
+
+	if (PPG_NUM > 1)
+	{
+		ppg_out("S:%u,B:%d,HR:%d\n", n, interval, bpm);
+	}
+	else
+	{
+		ppg_out("B:%d,HR:%d\n", interval, bpm);
+	}
+
+	return true;
+}
+#endif
+
+#ifdef CONFIG_APP_PPG_HR_SPECTRAL
+// Feed sample i of the run of sensor n to its spectral estimator, and once a
+// second print the rate (bpm, 0 without a confident one), the confidence (%)
+// and the time and cycles the update took
+static void ppg_hr_spectral_feed(uint8_t n, uint16_t i)
+{
+	struct ppg_hr_fft_result result;
+
+	if (!ppg_hr_fft_push(&ppg_spectra[n], ppg_filtered_counts(PPG_HR_CHANNEL, i)))
+	{
+		return;
+	}
 
-	ppg.setup(ledBrightnessRed, ledBrightnessIR, ledBrightnessGreen, sampleAverage, ledMode, sampleRate, pulseWidth, adcRange);
+	uint32_t start = k_cycle_get_32();
+#ifdef CONFIG_APP_PPG_HR_SPECTRAL_GOERTZEL
+	ppg_hr_fft_update_goertzel(&ppg_spectra[n], ppg_hr_fft_scratch, &result);
+#else
+	ppg_hr_fft_update(&ppg_spectra[n], ppg_hr_fft_scratch, &result);
+#endif
+	uint32_t cycles = k_cycle_get_32() - start;
 
-	uint32_t red;
-	uint32_t ir;
-	uint32_t green;
-	uint32_t samplesTaken = 0;
-	float sampleRateInHz;
-	int sampleingRateTarget = (sampleRate / sampleAverage) + 1;
-	uint32_t strat_time = k_uptime_get_32();
+	// Whole numbers, no float formatting
+	int bpm = (int)(result.bpm + 0.5f);
+	int confidence = (int)(result.confidence * 100.0f + 0.5f);
+	uint32_t us = k_cyc_to_us_floor32(cycles);
+
+	if (PPG_NUM > 1)
+	{
+		ppg_out("S:%u,HRS:%d,CONF:%d,US:%u,CYC:%u\n", n, bpm, confidence, us, cycles);
+	}
+	else
+	{
+		ppg_out("HRS:%d,CONF:%d,US:%u,CYC:%u\n", bpm, confidence, us, cycles);
+	}
+}
+#endif
+
+#ifdef CONFIG_APP_PPG_SPO2
+// Feed sample i of the run of sensor n, with whether the beat detector found
+// a beat there, and print the saturation (%), perfusion index (%) and ratio
+// of ratios once a second. All three are 0 without a reading.
+static void ppg_spo2_feed(uint8_t n, uint16_t i, bool beat)
+{
+	struct ppg_spo2_report report;
+
+	if (!ppg_spo2_update(&ppg_spo2s[n], ppg_filtered_counts(0, i),
+						 ppg_filtered_counts(1, i), beat, &report))
+	{
+		return;
+	}
+
+	// Fixed decimals from whole numbers, no float formatting
+	int spo2 = (int)(report.spo2 + 0.5f);
+	int pi = (int)(report.perfusion * 100.0f + 0.5f);
+	int ratio = (int)(report.ratio * 1000.0f + 0.5f);
+
+	if (PPG_NUM > 1)
+	{
+		ppg_out("S:%u,SPO2:%d,PI:%d.%02d,RR:%d.%03d\n", n, spo2, pi / 100, pi % 100,
+				ratio / 1000, ratio % 1000);
+	}
+	else
+	{
+		ppg_out("SPO2:%d,PI:%d.%02d,RR:%d.%03d\n", spo2, pi / 100, pi % 100,
+				ratio / 1000, ratio % 1000);
+	}
+}
+#endif
+
+void ppg_process_entry_point(void *a, void *b, void *c)
+{
+	uint32_t samplesTaken[PPG_NUM] = {};
+	uint32_t overruns[PPG_NUM] = {};
+	uint32_t temperatures[PPG_NUM] = {};
+
+	for (uint8_t n = 0; n < PPG_NUM; n++)
+	{
+		ppg_filter_reset(n);
+	}
 
 	while (1)
 	{
-		ppg.check(); // Check the sensor, read up to 3 samples
+		k_sem_take(&ppg_data_sem, K_FOREVER);
 
-		while (ppg.available()) // do we have new data?
+		for (uint8_t n = 0; n < PPG_NUM; n++)
 		{
-			samplesTaken++;
+			MAX30101 &ppg = ppg_sensors[n];
+
+			if (!ppg_ready[n] || ppg.available() == 0)
+			{
+				continue;
+			}
+
+			uint32_t sampleingRateTarget = (uint32_t)ppg_rate[n] + 1;
+
+			// Measured by the driver against the sensor's own clock, once per batch
+			LOG_DBG("PPG %u %.2f Hz, sensor clock %+.0f ppm", n,
+					(double)ppg.getSampleRate(), (double)ppg.getClockDrift());
+
+			if (ppg.getRingOverruns() != overruns[n])
+			{
+				LOG_WRN("PPG %u ring overrun, %u samples dropped", n, ppg.getRingOverruns() - overruns[n]);
+				overruns[n] = ppg.getRingOverruns();
+			}
+
+			float dieTemp;
+			if (ppg.getTemperatureCount() != temperatures[n] && ppg.getTemperature(&dieTemp))
+			{
+				LOG_DBG("PPG %u die %.2f C", n, (double)dieTemp);
+				temperatures[n] = ppg.getTemperatureCount();
+			}
 
-			// Get raw values and convert to float
-			float32_t raw_red = (float32_t)ppg.getFIFORed();
-			float32_t raw_ir = (float32_t)ppg.getFIFOIR();
-			float32_t raw_green = (float32_t)ppg.getFIFOGreen();
+			// Take every pending sample at once, in at most two runs
+			struct max30101_samples runs[2];
+			uint8_t runCount = ppg.getSamples(runs);
+			uint16_t consumed = 0;
+#ifdef CONFIG_APP_PPG_MOTION
+			uint16_t unaligned = 0; // Samples without acceleration
+#endif
 
-			sampleRateInHz = samplesTaken / ((k_uptime_get_32() - strat_time) / 1000.0);
+			for (uint8_t r = 0; r < runCount; r++)
+			{
+				const uint32_t *const raw[3] = {runs[r].red, runs[r].ir, runs[r].green};
+				uint16_t start = 0;
+
+				// Filter the whole run in one pass. A new sensor configuration
+				// starts the filters over at its first sample, so they don't
+				// carry the old signal level into it, with the coefficients
+				// for its rate.
+				if (runs[r].configStart >= 0)
+				{
+					start = runs[r].configStart;
+					ppg_filter_run(n, raw, 0, start);
+					ppg_filter_reset(n);
+				}
+				ppg_filter_run(n, raw, start, runs[r].count - start);
+
+				for (uint16_t i = 0; i < runs[r].count; i++)
+				{
+					samplesTaken[n]++;
+
+#ifdef CONFIG_APP_PPG_MOTION
+					// Before anything looks at the sample
+					float acc[PPG_MOTION_AXES];
+
+					if (!ppg_motion_feed(n, runs[r].timestamp[i], i, acc))
+					{
+						unaligned++;
+					}
+#endif
+
+#ifdef CONFIG_APP_PPG_GAP_MARKERS
+					// Samples lost right before this one, so the recorder can
+					// split the trace instead of joining across the gap
+					if (runs[r].gap[i] > 0)
+					{
+						ppg_out("GAP:%u\n", runs[r].gap[i]);
+					}
+#endif
+
+					if (samplesTaken[n] % sampleingRateTarget == 0)
+					{
+						samplesTaken[n] = 0;
+					}
+
+#ifndef CONFIG_APP_PPG_HR_BEATS_ONLY
+					// Print PPG data only if accelerometer data not ready
+					ppg_print(n, samplesTaken[n], i);
+#ifdef CONFIG_APP_PPG_MOTION
+					ppg_motion_print(n, acc);
+#endif
+#endif
+#if defined(CONFIG_APP_PPG_SPO2)
+					ppg_spo2_feed(n, i, ppg_hr_feed(n, i));
+#elif defined(CONFIG_APP_PPG_HR)
+					ppg_hr_feed(n, i);
+#endif
+#ifdef CONFIG_APP_PPG_HR_SPECTRAL
+					ppg_hr_spectral_feed(n, i);
+#endif
+
+#ifndef CONFIG_APP_PPG_MOTION
+					// Signal accelerometer to read data, its line goes right
+					// after the sample's
+					ppg_out_flush();
+					k_sem_give(&data_sem);
+#endif
+				}
+				consumed += runs[r].count;
+			}
 
-			if (samplesTaken % sampleingRateTarget == 0)
+			ppg.consumeSamples(consumed); // We're finished with the whole batch
+			ppg_out_flush();
+			k_yield();
+
+#ifdef CONFIG_APP_PPG_MOTION
+			if (unaligned > 0)
 			{
-				samplesTaken = 0;
+				LOG_DBG("PPG %u %u samples without acceleration", n, unaligned);
 			}
+#endif
+		}
+	}
+}
 
-			// Apply filters (in-place processing)
-			float32_t filtered_red = raw_red;
-			float32_t filtered_ir = raw_ir;
-			float32_t filtered_green = raw_green;
+#ifdef CONFIG_SHELL
+static const char *const ppg_i2c_op_names[MAX30101_I2C_OPS] = {
+	"read", "write", "burst read", "burst write"};
 
-			arm_biquad_cascade_df2T_f32(&red_iir_inst, &raw_red, &filtered_red, 1);
-			arm_biquad_cascade_df2T_f32(&ir_iir_inst, &raw_ir, &filtered_ir, 1);
-			arm_biquad_cascade_df2T_f32(&green_iir_inst, &raw_green, &filtered_green, 1);
+// Bus use of every MAX30101, to tell a saturated bus from slow processing
+static int cmd_ppg_i2c(const struct shell *sh, size_t argc, char **argv)
+{
+	struct max30101_i2c_stats stats;
 
-			// Print PPG data only if accelerometer data not ready
-			printk("C:%d,R:%.1f,IR:%.1f,G:%.1f\n",
-				   samplesTaken, filtered_red, filtered_ir, filtered_green);
+	for (uint8_t n = 0; n < PPG_NUM; n++)
+	{
+		ppg_sensors[n].getI2CStats(&stats);
 
-			ppg.nextSample(); // We're finished with this sample so move to next sample
+		shell_print(sh, "MAX30101 %u on %s, %u accesses avoided", n,
+					ppg_i2c[n].bus->name, stats.avoided);
+		shell_print(sh, "%-11s %8s %9s %6s %7s %8s %6s  latency <16,32,..,1024,more us",
+					"", "xfers", "bytes", "errors", "retries", "busy ms", "max us");
 
-			// Signal accelerometer to read data
-			k_sem_give(&data_sem);
+		for (int op = 0; op < MAX30101_I2C_OPS; op++)
+		{
+			const struct max30101_i2c_op_stats &s = stats.op[op];
 
-			k_yield();
+			shell_print(sh, "%-11s %8u %9u %6u %7u %8u %6u  %u %u %u %u %u %u %u %u",
+						ppg_i2c_op_names[op], s.transactions, s.bytes, s.errors,
+						s.retries, s.busyUs / 1000, s.maxUs, s.latency[0],
+						s.latency[1], s.latency[2], s.latency[3], s.latency[4],
+						s.latency[5], s.latency[6], s.latency[7]);
 		}
 	}
+
+	return 0;
 }
 
+static int cmd_ppg_i2c_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	// Races with the acquisition threads only lose a transfer or two
+	for (uint8_t n = 0; n < PPG_NUM; n++)
+	{
+		ppg_sensors[n].resetI2CStats();
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_ppg_i2c,
+							   SHELL_CMD(reset, NULL, "Clear the I2C statistics",
+										 cmd_ppg_i2c_reset),
+							   SHELL_SUBCMD_SET_END);
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_ppg,
+							   SHELL_CMD(i2c, &sub_ppg_i2c,
+										 "Show MAX30101 I2C statistics",
+										 cmd_ppg_i2c),
+							   SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(ppg, &sub_ppg, "PPG sensor commands", NULL);
+#endif
+
 void acc_entry_point(void *a, void *b, void *c)
 {
 	struct sensor_value accel[3];
 
+#ifndef CONFIG_APP_PPG_MOTION
 	double x, y, z;
+#endif
 
 	struct sensor_value odr_attr, fs_attr;
 
@@ -700,12 +1496,53 @@ void acc_entry_point(void *a, void *b, void *c)
 	if (!device_is_ready(adxl_dev))
 	{
 		LOG_ERR("adxl device is not ready\n");
+#ifdef CONFIG_APP_PPG_MOTION
+		return; // The PPG goes through without cancellation
+#endif
 	}
 
+#ifdef CONFIG_APP_PPG_MOTION
+	odr_attr.val1 = CONFIG_APP_PPG_MOTION_ACC_RATE;
+	odr_attr.val2 = 0;
+	if (sensor_attr_set(adxl_dev, SENSOR_CHAN_ACCEL_XYZ, SENSOR_ATTR_SAMPLING_FREQUENCY,
+						&odr_attr) < 0)
+	{
+		LOG_WRN("Accelerometer rate not set");
+	}
+
+	// Sample on our own clock for the motion cancellation. The stamp is when
+	// the read started, the output register is up to one ODR period older
+	// than that; a steady lag the adaptive filter's taps take up.
+	k_timer_start(&acc_timer, K_USEC(USEC_PER_SEC / CONFIG_APP_PPG_MOTION_ACC_RATE),
+				  K_USEC(USEC_PER_SEC / CONFIG_APP_PPG_MOTION_ACC_RATE));
+
+	while (1)
+	{
+		k_timer_status_sync(&acc_timer);
+
+		// Same clock as the MAX30101 sample timestamps
+		uint32_t at = (uint32_t)k_ticks_to_us_near64(k_uptime_ticks());
+
+		if (sensor_sample_fetch_chan(adxl_dev, SENSOR_CHAN_ACCEL_XYZ) != 0)
+		{
+			continue;
+		}
+		sensor_channel_get(adxl_dev, SENSOR_CHAN_ACCEL_XYZ, accel);
+
+		float acc[PPG_MOTION_AXES] = {(float)sensor_value_to_double(&accel[0]),
+									  (float)sensor_value_to_double(&accel[1]),
+									  (float)sensor_value_to_double(&accel[2])};
+
+		k_spinlock_key_t key = k_spin_lock(&acc_ring_lock);
+
+		ppg_motion_ring_push(&acc_ring, at, acc);
+		k_spin_unlock(&acc_ring_lock, key);
+	}
+#else
 	while (1)
 	{
 		// Wait for PPG data ready signal
-		if (k_sem_take(&data_sem, K_MSEC(10)) == 0)
+		if (k_sem_take(&data_sem, K_FOREVER) == 0)
 		{
 			// Read the acceleration data
 			if (sensor_sample_fetch_chan(adxl_dev, SENSOR_CHAN_ACCEL_XYZ) == 0)
@@ -722,4 +1559,5 @@ void acc_entry_point(void *a, void *b, void *c)
 			}
 		}
 	}
+#endif
 }
@@ -0,0 +1,63 @@
+/*
+    Block decoding of MAX30101 FIFO data.
+
+    Each FIFO record holds one 3-byte big-endian word per active LED slot, in
+    slot order (datasheet pg. 15). Only the low 18 bits carry data. These
+    helpers unpack a whole burst into per-channel arrays in a single pass.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX30101_FIFO_WORD_SIZE 3
+#define MAX30101_FIFO_DATA_MASK 0x3FFFF
+
+static inline uint32_t max30101_fifo_word(const uint8_t *p)
+{
+    return (((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2]) &
+           MAX30101_FIFO_DATA_MASK;
+}
+
+// Unpack 'samples' records of 'channels' words each from 'fifo' into out[0]
+// .. out[channels - 1]. The channel count is resolved once, outside the loop.
+// Returns the number of bytes consumed.
+static inline size_t max30101_fifo_unpack(
+    const uint8_t *fifo,
+    size_t samples,
+    uint8_t channels,
+    uint32_t *const out[])
+{
+    const uint8_t *p = fifo;
+    size_t i;
+
+    switch (channels)
+    {
+    case 1:
+        for (i = 0; i < samples; i++, p += 3)
+        {
+            out[0][i] = max30101_fifo_word(p);
+        }
+        break;
+    case 2:
+        for (i = 0; i < samples; i++, p += 6)
+        {
+            out[0][i] = max30101_fifo_word(p);
+            out[1][i] = max30101_fifo_word(p + 3);
+        }
+        break;
+    case 3:
+        for (i = 0; i < samples; i++, p += 9)
+        {
+            out[0][i] = max30101_fifo_word(p);
+            out[1][i] = max30101_fifo_word(p + 3);
+            out[2][i] = max30101_fifo_word(p + 6);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return (size_t)(p - fifo);
+}
@@ -0,0 +1,84 @@
+/*
+    Sample timestamp reconstruction for the MAX30101.
+
+    The sensor samples on its own oscillator, so the FIFO records carry no
+    time. What the MCU does know is when it read the FIFO state and how many
+    samples the sensor wrote since the previous read. A second order delay
+    locked loop (F. Adriaensen, "Using a DLL to filter time", 2005) fits a
+    line through those observations: newest_us is the estimated time the most
+    recent sample was written and period_us the sample period measured against
+    the MCU clock. Read latency jitter is filtered out, a constant latency
+    shows up as a constant offset (at most one sample period when polling).
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Loop gains, about 0.005 Hz bandwidth with four FIFO reads per second:
+// omega = 2 * pi * 0.005 * 0.25, B = sqrt(2) * omega, C = omega ^ 2
+// Polling adds up to a sample period of jitter to every read, a narrow loop
+// averages it out (about 10 ppm residual) and settles in a minute or two.
+// Oscillator drift with temperature is far slower than that.
+#define MAX30101_TIMEBASE_B 0.0111f
+#define MAX30101_TIMEBASE_C 0.0000617f
+
+// Re-anchor instead of filtering when a read is off by more than this many
+// sample periods (lost samples not accounted for, long stall, clock jump)
+#define MAX30101_TIMEBASE_RESYNC 8
+
+struct max30101_timebase
+{
+    int64_t newest_us; // Time the newest sample was written, MCU clock
+    float period_us;   // Measured sample period
+    float nominal_us;  // Sample period from the sensor configuration
+    uint32_t updates;  // Reads since the last reset, 0 means no anchor
+};
+
+static inline void max30101_timebase_reset(
+    struct max30101_timebase *tb, float nominal_us)
+{
+    tb->newest_us = 0;
+    tb->period_us = nominal_us;
+    tb->nominal_us = nominal_us;
+    tb->updates = 0;
+}
+
+// Feed one FIFO state read: at 'now_us' the sensor had written 'written'
+// samples since the previous call
+static inline void max30101_timebase_update(
+    struct max30101_timebase *tb, int64_t now_us, uint32_t written)
+{
+    if (written == 0)
+        return;
+
+    int64_t predicted = tb->newest_us + (int64_t)(written * tb->period_us);
+    float error = (float)(now_us - predicted);
+    float limit = MAX30101_TIMEBASE_RESYNC * tb->period_us;
+
+    if (tb->updates == 0 || error > limit || error < -limit)
+    {
+        // Keep the period, it is still the best estimate we have
+        tb->newest_us = now_us;
+        tb->updates = 1;
+        return;
+    }
+
+    tb->newest_us = predicted + (int64_t)(MAX30101_TIMEBASE_B * error);
+    tb->period_us += MAX30101_TIMEBASE_C * error / written;
+    tb->updates++;
+}
+
+// Time of the sample written 'age' samples before the newest one
+static inline int64_t max30101_timebase_at(
+    const struct max30101_timebase *tb, uint32_t age)
+{
+    return tb->newest_us - (int64_t)(age * tb->period_us);
+}
+
+// Sensor clock error against the MCU clock, positive when the sensor is slow
+static inline float max30101_timebase_drift_ppm(
+    const struct max30101_timebase *tb)
+{
+    return (tb->period_us / tb->nominal_us - 1.0f) * 1e6f;
+}
@@ -0,0 +1,240 @@
+/*
+    PPG filtering over whole sample batches, with the filter designed in
+    app/dsp/ppg_filters.yaml (a low-pass at the moment).
+
+    ppg_filter_block() runs one channel through its own CMSIS-DSP transposed
+    direct form II biquad cascade. The samples of a batch are converted to
+    float into one contiguous array and filtered in a single call, so the
+    per-call setup is paid once per channel per batch instead of once per
+    sample, and the kernel's unrolled loop (four samples per iteration) does
+    the work. The filter state lives in the instance and carries across
+    batches.
+
+    A filter bank runs any number of channels in lockstep through the same
+    cascade instead, which is what the process thread uses: one pass over the
+    batch, every stage applied to all channels of a sample before moving on,
+    and no per-channel calls. The state is stored structure of arrays, one row
+    of channels per delay element, so the inner loops walk contiguous memory
+    and vectorize where the target has SIMD (MVE, and SSE/NEON on the host).
+
+    The fixed point option filters in Q31 or Q15 with the CMSIS-DSP direct
+    form I kernels, one call per channel per batch. The ADC counts are
+    shifted into place straight from the driver's integer buffers, and the
+    output is read back as counts, so no float is involved anywhere. In Q31
+    the 18 bit counts sit one bit below full scale: as long as the cascade's
+    worst case gain (sum of |h[n]|) stays below 2, which the generator checks
+    (PPG_IIR_FIXED_POINT_SAFE), the output can't overflow the q31 kernel,
+    which doesn't saturate. Q15 has to drop the four low bits of each count
+    to keep the same headroom, and saturates.
+
+    The coefficients come from ppg_filter_coeffs.h, which the build generates
+    from app/dsp/ppg_filters.yaml: one table per supported output data rate,
+    in float, Q31 and Q15. ppg_filter_select() picks the table for a rate, so
+    changing the sample rate or averaging needs no design math on the device.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "arm_math.h"
+#include "ppg_filter_coeffs.h"
+
+// ADC counts to Q31 (up) and Q15 (down), see above
+#define PPG_Q31_SHIFT 12
+#define PPG_Q15_SHIFT 4
+
+// Index of the coefficient table for the rate nearest to 'fs' (Hz), by ratio.
+// -1 below the lowest or above the highest table rate: no table there is
+// close, and past the ends the corners may not even be below Nyquist.
+static inline int ppg_filter_select(float32_t fs)
+{
+    if (!(fs >= ppg_iir_rates[0] && fs <= ppg_iir_rates[PPG_IIR_TABLES - 1]))
+    {
+        return -1;
+    }
+
+    int best = 0;
+    float32_t bestRatio = 0.0f;
+
+    for (uint8_t t = 0; t < PPG_IIR_TABLES; t++)
+    {
+        float32_t ratio = fs > ppg_iir_rates[t] ? fs / ppg_iir_rates[t]
+                                                : ppg_iir_rates[t] / fs;
+
+        if (t == 0 || ratio < bestRatio)
+        {
+            best = t;
+            bestRatio = ratio;
+        }
+    }
+
+    return best;
+}
+
+static inline void ppg_filter_init(
+    arm_biquad_cascade_df2T_instance_f32 *iir,
+    float32_t state[2 * PPG_IIR_NUMSTAGES],
+    uint8_t table)
+{
+    arm_biquad_cascade_df2T_init_f32(
+        iir, PPG_IIR_NUMSTAGES, ppg_iir_coeffs[table], state);
+}
+
+// Filter 'count' raw ADC counts of one channel into out[0] .. out[count - 1].
+// The conversion writes straight into 'out' and the cascade runs in place.
+static inline void ppg_filter_block(
+    const arm_biquad_cascade_df2T_instance_f32 *iir,
+    const uint32_t *raw,
+    float32_t *out,
+    uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        out[i] = (float32_t)raw[i];
+    }
+
+    arm_biquad_cascade_df2T_f32(iir, out, out, count);
+}
+
+// Floats of storage a bank of 'channels' needs: two delay rows per stage and
+// a row for the sample being filtered
+#define PPG_FILTER_BANK_SIZE(channels) \
+    ((2 * PPG_IIR_NUMSTAGES + 1) * (channels))
+
+struct ppg_filter_bank
+{
+    uint16_t channels;
+    const float32_t *coeffs; // One of ppg_iir_coeffs[]
+    float32_t *state;        // PPG_FILTER_BANK_SIZE(channels) floats
+};
+
+// Start the filters over from rest, as after ppg_filter_bank_init()
+static inline void ppg_filter_bank_reset(struct ppg_filter_bank *bank)
+{
+    for (uint32_t i = 0; i < PPG_FILTER_BANK_SIZE(bank->channels); i++)
+    {
+        bank->state[i] = 0.0f;
+    }
+}
+
+static inline void ppg_filter_bank_init(
+    struct ppg_filter_bank *bank,
+    uint16_t channels,
+    float32_t *state,
+    uint8_t table)
+{
+    bank->channels = channels;
+    bank->coeffs = ppg_iir_coeffs[table];
+    bank->state = state;
+    ppg_filter_bank_reset(bank);
+}
+
+// Filter 'count' raw ADC counts of every channel, raw[ch][i] into
+// out[ch][i]. Same arithmetic, in the same order, as
+// arm_biquad_cascade_df2T_f32() on each channel.
+static inline void ppg_filter_bank_run(
+    const struct ppg_filter_bank *bank,
+    const uint32_t *const raw[],
+    float32_t *const out[],
+    uint32_t count)
+{
+    const uint16_t channels = bank->channels;
+    float32_t *__restrict x = bank->state +
+                              2 * PPG_IIR_NUMSTAGES * channels;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        for (uint16_t ch = 0; ch < channels; ch++)
+        {
+            x[ch] = (float32_t)raw[ch][i];
+        }
+
+        for (uint8_t stage = 0; stage < PPG_IIR_NUMSTAGES; stage++)
+        {
+            const float32_t *coeffs = &bank->coeffs[5 * stage];
+            const float32_t b0 = coeffs[0], b1 = coeffs[1], b2 = coeffs[2];
+            const float32_t a1 = coeffs[3], a2 = coeffs[4];
+            float32_t *__restrict d1 = bank->state + 2 * stage * channels;
+            float32_t *__restrict d2 = d1 + channels;
+
+            for (uint16_t ch = 0; ch < channels; ch++)
+            {
+                const float32_t in = x[ch];
+                const float32_t acc = b0 * in + d1[ch];
+
+                d1[ch] = b1 * in + d2[ch];
+                d1[ch] += a1 * acc;
+                d2[ch] = b2 * in;
+                d2[ch] += a2 * acc;
+                x[ch] = acc;
+            }
+        }
+
+        for (uint16_t ch = 0; ch < channels; ch++)
+        {
+            out[ch][i] = x[ch];
+        }
+    }
+}
+
+static inline void ppg_filter_init_q31(
+    arm_biquad_casd_df1_inst_q31 *iir,
+    q31_t state[4 * PPG_IIR_NUMSTAGES],
+    uint8_t table)
+{
+    arm_biquad_cascade_df1_init_q31(
+        iir, PPG_IIR_NUMSTAGES, ppg_iir_coeffs_q31[table], state,
+        ppg_iir_postshift[table]);
+}
+
+// ppg_filter_block() in Q31, out[] holds counts << PPG_Q31_SHIFT
+static inline void ppg_filter_block_q31(
+    const arm_biquad_casd_df1_inst_q31 *iir,
+    const uint32_t *raw,
+    q31_t *out,
+    uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        out[i] = (q31_t)(raw[i] << PPG_Q31_SHIFT);
+    }
+
+    arm_biquad_cascade_df1_q31(iir, out, out, count);
+}
+
+// Filter output back in ADC counts, rounded
+static inline int32_t ppg_filter_counts_q31(q31_t y)
+{
+    return (y + (1 << (PPG_Q31_SHIFT - 1))) >> PPG_Q31_SHIFT;
+}
+
+static inline void ppg_filter_init_q15(
+    arm_biquad_casd_df1_inst_q15 *iir,
+    q15_t state[4 * PPG_IIR_NUMSTAGES],
+    uint8_t table)
+{
+    arm_biquad_cascade_df1_init_q15(
+        iir, PPG_IIR_NUMSTAGES, ppg_iir_coeffs_q15[table], state,
+        ppg_iir_postshift[table]);
+}
+
+// ppg_filter_block() in Q15, out[] holds counts >> PPG_Q15_SHIFT
+static inline void ppg_filter_block_q15(
+    const arm_biquad_casd_df1_inst_q15 *iir,
+    const uint32_t *raw,
+    q15_t *out,
+    uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        out[i] = (q15_t)(raw[i] >> PPG_Q15_SHIFT);
+    }
+
+    arm_biquad_cascade_df1_q15(iir, out, out, count);
+}
+
+static inline int32_t ppg_filter_counts_q15(q15_t y)
+{
+    return (int32_t)y * (1 << PPG_Q15_SHIFT);
+}
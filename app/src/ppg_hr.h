@@ -0,0 +1,239 @@
+/*
+    Streaming heart rate from one filtered PPG channel.
+
+    ppg_hr_update() takes one sample at a time and reports a beat at each
+    systolic peak, with the interval since the previous one. Memory and work
+    per sample are constant, no history is kept.
+
+    - The DC level is tracked by an exponential average and subtracted, and
+      the sign flipped: more blood in the tissue absorbs more light, so the
+      pulse shows as a dip in the ADC counts.
+    - The signal is measured from the lowest point since the previous beat,
+      the foot of the pulse, so breathing and motion moving the level up and
+      down between beats don't hide a beat or make one.
+    - A beat is the highest point of a rise above an adaptive threshold, a
+      fraction of the rise envelope. The envelope follows a higher rise at
+      once and decays slowly otherwise, so the detector adapts to the
+      amplitude in both directions.
+    - After a beat the detector ignores the signal for the shortest interval
+      at PPG_HR_MAX_BPM, which also keeps the dicrotic wave from counting.
+    - Without a beat for longer than the interval at PPG_HR_MIN_BPM, a
+      transient (a knock, a step in the level) has most likely left the
+      trough or the envelope where the pulse can't reach. The search starts
+      over from the current sample, learning the envelope again first.
+    - Intervals outside PPG_HR_MIN_BPM .. PPG_HR_MAX_BPM, or too far from the
+      running average (a missed or an extra beat), are not reported. A few of
+      those in a row are taken as a real change of rate instead.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PPG_HR_MIN_BPM 30
+#define PPG_HR_MAX_BPM 220
+
+// Time constants of the DC tracking and of the envelope decay, seconds
+#define PPG_HR_BASELINE_S 1.0f
+#define PPG_HR_ENVELOPE_S 3.0f
+
+// Time after a reset before beats are reported, the filters and the DC
+// tracking settle meanwhile, seconds
+#define PPG_HR_SETTLE_S 1.5f
+
+// Threshold as a fraction of the envelope
+#define PPG_HR_THRESHOLD 0.6f
+
+// An interval further than this fraction from the average is an artifact,
+// until this many come in a row
+#define PPG_HR_TOLERANCE 0.3f
+#define PPG_HR_REJECTS 3
+
+// Weight of a new interval in the average
+#define PPG_HR_SMOOTHING 0.25f
+
+struct ppg_hr
+{
+    float fs;            // Sample rate, Hz
+    float dcAlpha;       // DC tracking weight per sample
+    float decay;         // Envelope decay per sample
+    uint32_t settle;     // Samples before detection starts after a reset
+    uint32_t minGap;     // Refractory period, samples
+    uint32_t maxGap;     // Longest interval, samples
+
+    uint32_t n;          // Samples since the reset
+    uint32_t detectFrom; // Sample index detection (re)starts at
+    uint32_t searchFrom; // Sample index of the last beat or (re)start
+    float dc;            // Tracked DC level
+    float trough;        // Lowest point since the previous beat
+    float envelope;      // Envelope of the rises from the trough
+    bool above;          // Inside a rise above the threshold
+    float peak;          // Highest point of that rise
+    uint32_t peakAt;     // and its sample index
+    bool haveBeat;       // lastBeat is valid
+    uint32_t lastBeat;   // Sample index of the previous beat
+    float average;       // Average interval, samples, 0 until the first one
+    uint8_t rejects;     // Intervals rejected in a row
+};
+
+struct ppg_hr_beat
+{
+    uint32_t at;       // Sample index of the peak since the reset
+    float amplitude;   // Foot to peak, in the input's units
+    float intervalMs;  // Since the previous beat, 0 if not usable
+    float bpm;         // Average rate, 0 until there is one
+};
+
+static inline void ppg_hr_reset(struct ppg_hr *hr, float fs)
+{
+    hr->fs = fs;
+    hr->dcAlpha = 1.0f / (PPG_HR_BASELINE_S * fs);
+    hr->decay = 1.0f - 1.0f / (PPG_HR_ENVELOPE_S * fs);
+    hr->settle = (uint32_t)(PPG_HR_SETTLE_S * fs);
+    hr->minGap = (uint32_t)(60.0f * fs / PPG_HR_MAX_BPM);
+    hr->maxGap = (uint32_t)(60.0f * fs / PPG_HR_MIN_BPM);
+
+    hr->n = 0;
+    hr->detectFrom = hr->settle;
+    hr->searchFrom = hr->settle;
+    hr->dc = 0.0f;
+    hr->trough = 0.0f;
+    hr->envelope = 0.0f;
+    hr->above = false;
+    hr->peak = 0.0f;
+    hr->peakAt = 0;
+    hr->haveBeat = false;
+    hr->lastBeat = 0;
+    hr->average = 0.0f;
+    hr->rejects = 0;
+}
+
+// Whether a beat this many samples after the previous one goes into the
+// average
+static inline bool ppg_hr_accept(struct ppg_hr *hr, uint32_t interval)
+{
+    if (interval > hr->maxGap)
+    {
+        // Lost track (no signal, or beats missed), start the average over
+        hr->average = 0.0f;
+        hr->rejects = 0;
+        return false;
+    }
+
+    float deviation = (float)interval - hr->average;
+
+    if (hr->average == 0.0f)
+    {
+        hr->average = (float)interval;
+    }
+    else if (deviation <= PPG_HR_TOLERANCE * hr->average &&
+             deviation >= -PPG_HR_TOLERANCE * hr->average)
+    {
+        hr->average += PPG_HR_SMOOTHING * deviation;
+    }
+    else if (++hr->rejects < PPG_HR_REJECTS)
+    {
+        return false;
+    }
+    else
+    {
+        hr->average = (float)interval;
+    }
+
+    hr->rejects = 0;
+    return true;
+}
+
+// Feed the next sample. Returns true, with the beat in *beat, when the sample
+// ends the rise of a systolic peak.
+static inline bool ppg_hr_update(
+    struct ppg_hr *hr, float x, struct ppg_hr_beat *beat)
+{
+    uint32_t n = hr->n++;
+
+    if (n < hr->settle / 2)
+    {
+        // The filters are still coming up from rest, follow them closely
+        hr->dc = x;
+        return false;
+    }
+
+    hr->dc += hr->dcAlpha * (x - hr->dc);
+
+    float v = hr->dc - x;
+
+    // Lost track, see above. The next interval is too long to count anyway.
+    if (n >= hr->detectFrom && n - hr->searchFrom > hr->maxGap)
+    {
+        hr->trough = v;
+        hr->envelope = 0.0f;
+        hr->above = false;
+        hr->detectFrom = n + (hr->settle - hr->settle / 2);
+        hr->searchFrom = hr->detectFrom;
+    }
+
+    if (v < hr->trough)
+    {
+        hr->trough = v;
+    }
+
+    float rise = v - hr->trough;
+
+    hr->envelope *= hr->decay;
+    if (rise > hr->envelope)
+    {
+        hr->envelope = rise;
+    }
+
+    if (n < hr->detectFrom)
+    {
+        return false;
+    }
+
+    if (!hr->above)
+    {
+        bool refractory = hr->haveBeat && n - hr->lastBeat < hr->minGap;
+
+        if (rise > PPG_HR_THRESHOLD * hr->envelope && !refractory)
+        {
+            hr->above = true;
+            hr->peak = rise;
+            hr->peakAt = n;
+        }
+        return false;
+    }
+
+    if (rise > hr->peak)
+    {
+        hr->peak = rise;
+        hr->peakAt = n;
+    }
+
+    // The rise ends once the signal has fallen well off its highest point,
+    // relative to that point so that noise on the way up doesn't end it
+    if (rise >= PPG_HR_THRESHOLD * hr->peak)
+    {
+        return false;
+    }
+
+    // The rise's highest point is the beat. Look for the next foot from here.
+    hr->above = false;
+    hr->trough = v;
+    hr->searchFrom = n;
+
+    beat->at = hr->peakAt;
+    beat->amplitude = hr->peak;
+    beat->intervalMs = 0.0f;
+
+    if (hr->haveBeat && ppg_hr_accept(hr, hr->peakAt - hr->lastBeat))
+    {
+        beat->intervalMs = 1000.0f * (hr->peakAt - hr->lastBeat) / hr->fs;
+    }
+    beat->bpm = hr->average > 0.0f ? 60.0f * hr->fs / hr->average : 0.0f;
+
+    hr->haveBeat = true;
+    hr->lastBeat = hr->peakAt;
+
+    return true;
+}
@@ -0,0 +1,334 @@
+/*
+    Spectral heart rate from one filtered PPG channel.
+
+    Where the signal is too noisy for the beat detector (src/ppg_hr.h), the
+    pulse still stands out in the spectrum. ppg_hr_fft_push() takes the
+    samples as they stream in, box-car decimates them to about
+    PPG_HR_FFT_RATE and keeps the last PPG_HR_FFT_WINDOW of them in a ring,
+    8 s. Once a second of new samples it asks for an update, which
+    takes the ring oldest first, removes the mean and applies a Hann
+    window precomputed at init. It then finds the strongest peak between
+    PPG_HR_MIN_BPM and PPG_HR_MAX_BPM, interpolated between bins.
+
+    - ppg_hr_fft_update() gets the whole spectrum with arm_rfft_fast_f32(),
+      zero padded to twice the window for finer bins.
+    - ppg_hr_fft_update_goertzel() evaluates the same bins one at a time with
+      the Goertzel recurrence, only the band, and once locked only the bins
+      around the last estimate, for low power. Every PPG_HR_FFT_FULL_EVERY
+      updates it still covers the whole band, so it finds a much stronger
+      peak further away as the FFT would, a few seconds later. The power in
+      a bin is the same either way.
+
+    Once locked, the tracker keeps to the peak near the last estimate unless
+    another one is much stronger, so a motion harmonic or the second harmonic
+    of the pulse doesn't capture it. Confidence is the share of the window's
+    energy around the peak, below PPG_HR_FFT_MIN_CONFIDENCE there is no
+    estimate.
+
+    The decimation makes the window and transform size the same at every
+    sample rate. The update is kept apart from the push so the caller can time
+    it, or run it somewhere else.
+*/
+
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arm_math.h"
+#include "ppg_hr.h"
+
+// Analysis rate the input is decimated to, about, Hz
+#define PPG_HR_FFT_RATE 16.0f
+
+// Samples at the analysis rate in a window, and transform size
+#define PPG_HR_FFT_WINDOW 128
+#define PPG_HR_FFT_SIZE (2 * PPG_HR_FFT_WINDOW)
+
+// Floats of scratch an update needs
+#define PPG_HR_FFT_SCRATCH (2 * PPG_HR_FFT_SIZE)
+
+// Once locked, a peak this close to the last estimate is kept if it has at
+// least this share of the strongest one's power
+#define PPG_HR_FFT_TRACK_BPM 15.0f
+#define PPG_HR_FFT_TRACK_RATIO 0.5f
+
+// Bins either side of the peak that count towards its energy, the Hann main
+// lobe is four either side with the zero padding
+#define PPG_HR_FFT_LOBE 2
+
+#define PPG_HR_FFT_MIN_CONFIDENCE 0.15f
+
+// Updates, while locked, between the ones where the Goertzel bank covers the
+// whole band
+#define PPG_HR_FFT_FULL_EVERY 5
+
+// Hann window, and the Goertzel coefficient 2 cos(2 pi k / N) of each bin.
+// They depend on the sizes only, so the first init fills them.
+static float32_t ppg_hr_fft_hann[PPG_HR_FFT_WINDOW];
+static float32_t ppg_hr_fft_goertzel[PPG_HR_FFT_SIZE / 2];
+static bool ppg_hr_fft_tables;
+
+struct ppg_hr_fft
+{
+    arm_rfft_fast_instance_f32 rfft;
+    float32_t rate;       // Analysis rate, Hz
+    uint16_t decimate;    // Input samples per analysis sample
+    uint16_t hop;         // Analysis samples per update
+    uint16_t minBin;      // Band, in bins
+    uint16_t maxBin;
+
+    float32_t acc;        // Input samples summed for the next analysis one
+    uint16_t phase;       // and how many
+    float32_t ring[PPG_HR_FFT_WINDOW];
+    uint16_t head;        // Oldest sample, where the next one goes
+    uint16_t filled;
+    uint16_t sinceUpdate;
+    uint16_t sinceFull;   // Goertzel updates since the last of the whole band
+    float32_t bpm;        // Last estimate, 0 when not locked
+};
+
+struct ppg_hr_fft_result
+{
+    float32_t bpm;        // 0 without a confident estimate
+    float32_t confidence; // Share of the energy around the peak, 0 .. 1
+    uint16_t bins;        // Bins evaluated
+};
+
+static inline arm_status ppg_hr_fft_init(struct ppg_hr_fft *s, float32_t fs)
+{
+    if (!ppg_hr_fft_tables)
+    {
+        for (uint16_t k = 0; k < PPG_HR_FFT_WINDOW; k++)
+        {
+            ppg_hr_fft_hann[k] = 0.5f - 0.5f * cosf(2.0f * PI * k / PPG_HR_FFT_WINDOW);
+        }
+        for (uint16_t k = 0; k < PPG_HR_FFT_SIZE / 2; k++)
+        {
+            ppg_hr_fft_goertzel[k] = 2.0f * cosf(2.0f * PI * k / PPG_HR_FFT_SIZE);
+        }
+        ppg_hr_fft_tables = true;
+    }
+
+    s->decimate = fs > PPG_HR_FFT_RATE ? (uint16_t)(fs / PPG_HR_FFT_RATE + 0.5f) : 1;
+    s->rate = fs / s->decimate;
+    s->hop = (uint16_t)(s->rate + 0.5f);
+
+    // Keep the lobe either side of the band inside the spectrum
+    float32_t binsPerBpm = PPG_HR_FFT_SIZE / (60.0f * s->rate);
+
+    s->minBin = (uint16_t)ceilf(PPG_HR_MIN_BPM * binsPerBpm);
+    s->maxBin = (uint16_t)(PPG_HR_MAX_BPM * binsPerBpm);
+    if (s->minBin < PPG_HR_FFT_LOBE)
+    {
+        s->minBin = PPG_HR_FFT_LOBE;
+    }
+    if (s->maxBin > PPG_HR_FFT_SIZE / 2 - 1 - PPG_HR_FFT_LOBE)
+    {
+        s->maxBin = PPG_HR_FFT_SIZE / 2 - 1 - PPG_HR_FFT_LOBE;
+    }
+
+    s->acc = 0.0f;
+    s->phase = 0;
+    s->head = 0;
+    s->filled = 0;
+    s->sinceUpdate = 0;
+    s->sinceFull = 0;
+    s->bpm = 0.0f;
+
+    return arm_rfft_fast_init_f32(&s->rfft, PPG_HR_FFT_SIZE);
+}
+
+// Feed the next sample. Returns true when an update is due.
+static inline bool ppg_hr_fft_push(struct ppg_hr_fft *s, float32_t x)
+{
+    s->acc += x;
+    if (++s->phase < s->decimate)
+    {
+        return false;
+    }
+
+    s->ring[s->head] = s->acc / s->decimate;
+    s->head = (s->head + 1) % PPG_HR_FFT_WINDOW;
+    s->acc = 0.0f;
+    s->phase = 0;
+
+    if (s->filled < PPG_HR_FFT_WINDOW)
+    {
+        s->filled++;
+    }
+    if (++s->sinceUpdate < s->hop || s->filled < PPG_HR_FFT_WINDOW)
+    {
+        return false;
+    }
+
+    s->sinceUpdate = 0;
+    return true;
+}
+
+// The ring oldest first, mean removed and windowed, into x[]. Returns the
+// energy of the result.
+static inline float32_t ppg_hr_fft_window(const struct ppg_hr_fft *s, float32_t *x)
+{
+    float32_t mean = 0.0f;
+    float32_t energy = 0.0f;
+
+    for (uint16_t k = 0; k < PPG_HR_FFT_WINDOW; k++)
+    {
+        mean += s->ring[k];
+    }
+    mean /= PPG_HR_FFT_WINDOW;
+
+    for (uint16_t k = 0; k < PPG_HR_FFT_WINDOW; k++)
+    {
+        float32_t v = s->ring[(s->head + k) % PPG_HR_FFT_WINDOW] - mean;
+
+        x[k] = v * ppg_hr_fft_hann[k];
+        energy += x[k] * x[k];
+    }
+
+    return energy;
+}
+
+// Bins the tracker looks in around the last estimate
+static inline void ppg_hr_fft_track(const struct ppg_hr_fft *s, int *lo, int *hi)
+{
+    float32_t binsPerBpm = PPG_HR_FFT_SIZE / (60.0f * s->rate);
+    int centre = (int)(s->bpm * binsPerBpm + 0.5f);
+    int reach = (int)(PPG_HR_FFT_TRACK_BPM * binsPerBpm + 0.5f);
+
+    *lo = centre - reach < s->minBin ? s->minBin : centre - reach;
+    *hi = centre + reach > s->maxBin ? s->maxBin : centre + reach;
+}
+
+// Pick the peak of power[lo .. hi] (valid PPG_HR_FFT_LOBE bins further either
+// side), update the tracker and fill in the result
+static inline void ppg_hr_fft_pick(
+    struct ppg_hr_fft *s, const float32_t *power, int lo, int hi,
+    float32_t energy, struct ppg_hr_fft_result *r)
+{
+    int peak = lo;
+
+    for (int k = lo; k <= hi; k++)
+    {
+        if (power[k] > power[peak])
+        {
+            peak = k;
+        }
+    }
+
+    if (s->bpm > 0.0f)
+    {
+        int from, to;
+
+        ppg_hr_fft_track(s, &from, &to);
+
+        int near = from;
+
+        for (int k = from; k <= to; k++)
+        {
+            if (power[k] > power[near])
+            {
+                near = k;
+            }
+        }
+        if (power[near] >= PPG_HR_FFT_TRACK_RATIO * power[peak])
+        {
+            peak = near;
+        }
+    }
+
+    // Parabola through the log power of the peak and its neighbours, exact
+    // for a Gaussian lobe and close for Hann
+    float32_t a = logf(power[peak - 1] + 1e-20f);
+    float32_t b = logf(power[peak] + 1e-20f);
+    float32_t c = logf(power[peak + 1] + 1e-20f);
+    float32_t den = a - 2.0f * b + c;
+    float32_t delta = den < 0.0f ? 0.5f * (a - c) / den : 0.0f;
+
+    if (delta > 0.5f || delta < -0.5f)
+    {
+        delta = 0.0f;
+    }
+
+    // Both sides of the spectrum, by Parseval N times the energy in all
+    float32_t around = 0.0f;
+
+    for (int k = peak - PPG_HR_FFT_LOBE; k <= peak + PPG_HR_FFT_LOBE; k++)
+    {
+        around += power[k];
+    }
+
+    r->confidence = energy > 0.0f ? 2.0f * around / (PPG_HR_FFT_SIZE * energy) : 0.0f;
+    r->bpm = 0.0f;
+    if (r->confidence >= PPG_HR_FFT_MIN_CONFIDENCE)
+    {
+        r->bpm = (peak + delta) * 60.0f * s->rate / PPG_HR_FFT_SIZE;
+    }
+    s->bpm = r->bpm;
+}
+
+// Estimate from the whole spectrum. 'scratch' is PPG_HR_FFT_SCRATCH floats.
+static inline void ppg_hr_fft_update(
+    struct ppg_hr_fft *s, float32_t *scratch, struct ppg_hr_fft_result *r)
+{
+    float32_t *x = scratch;
+    float32_t *spectrum = scratch + PPG_HR_FFT_SIZE;
+    float32_t energy = ppg_hr_fft_window(s, x);
+
+    for (uint16_t k = PPG_HR_FFT_WINDOW; k < PPG_HR_FFT_SIZE; k++)
+    {
+        x[k] = 0.0f;
+    }
+
+    arm_rfft_fast_f32(&s->rfft, x, spectrum, 0);
+
+    // Power of the band, into the input, which the transform has used up
+    for (int k = s->minBin - PPG_HR_FFT_LOBE; k <= s->maxBin + PPG_HR_FFT_LOBE; k++)
+    {
+        x[k] = spectrum[2 * k] * spectrum[2 * k] +
+               spectrum[2 * k + 1] * spectrum[2 * k + 1];
+    }
+
+    ppg_hr_fft_pick(s, x, s->minBin, s->maxBin, energy, r);
+    r->bins = PPG_HR_FFT_SIZE / 2;
+}
+
+// Estimate from the bins that matter only, see above. 'scratch' is
+// PPG_HR_FFT_SCRATCH floats.
+static inline void ppg_hr_fft_update_goertzel(
+    struct ppg_hr_fft *s, float32_t *scratch, struct ppg_hr_fft_result *r)
+{
+    float32_t *x = scratch;
+    float32_t *power = scratch + PPG_HR_FFT_SIZE;
+    float32_t energy = ppg_hr_fft_window(s, x);
+    int lo = s->minBin, hi = s->maxBin;
+
+    if (s->bpm > 0.0f && ++s->sinceFull < PPG_HR_FFT_FULL_EVERY)
+    {
+        ppg_hr_fft_track(s, &lo, &hi);
+    }
+    else
+    {
+        s->sinceFull = 0;
+    }
+
+    for (int k = lo - PPG_HR_FFT_LOBE; k <= hi + PPG_HR_FFT_LOBE; k++)
+    {
+        const float32_t coeff = ppg_hr_fft_goertzel[k];
+        float32_t s1 = 0.0f, s2 = 0.0f;
+
+        for (uint16_t i = 0; i < PPG_HR_FFT_WINDOW; i++)
+        {
+            float32_t s0 = x[i] + coeff * s1 - s2;
+
+            s2 = s1;
+            s1 = s0;
+        }
+        power[k] = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+    }
+
+    ppg_hr_fft_pick(s, power, lo, hi, energy, r);
+    r->bins = hi - lo + 1 + 2 * PPG_HR_FFT_LOBE;
+}
@@ -0,0 +1,241 @@
+/*
+    Motion artifact cancellation with the accelerometer as noise reference.
+
+    Movement shows up in the PPG as the tissue and the sensor shift, and the
+    accelerometer sees the same movement. An adaptive FIR filter per PPG
+    channel learns how the three axes map to the artifact and subtracts its
+    estimate, before anything looks at the samples (print, heart rate, SpO2).
+
+    The accelerometer is sampled on its own clock, so ppg_motion_ring keeps
+    its recent samples with their time, in the same microseconds of uptime as
+    the MAX30101 sample timestamps, and ppg_motion_ring_at() interpolates the
+    acceleration at the time of each PPG sample.
+
+    The filter is a normalized LMS over all three axes at once, each
+    PPG_MOTION_TAPS samples long, so the step is scaled by the energy of the
+    whole reference. The gravity and the PPG's DC level are tracked and taken
+    out of the adaptation (the DC level stays in the output), and the step
+    never grows as if the reference were quieter than PPG_MOTION_MIN_RMS, so
+    at rest the filter doesn't chase the pulse with sensor noise. A sample
+    costs 2 x 3 x PPG_MOTION_TAPS multiply-adds per channel, and 3 x
+    PPG_MOTION_TAPS for the reference energy, whatever the sample rate.
+*/
+
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PPG_MOTION_AXES 3
+#define PPG_MOTION_CHANNELS 3
+
+// Filter length per axis, in PPG samples
+#define PPG_MOTION_TAPS 8
+
+// Accelerometer samples kept, a power of two. Has to reach back over the
+// time from a PPG sample to its processing, a FIFO batch and then some.
+#define PPG_MOTION_RING 128
+
+// Time constant of the gravity and DC trackers, s
+#define PPG_MOTION_DC_TAU 3.0f
+
+// After a reset, the trackers follow the input for this long, s, while the
+// filters come up from rest. No adaptation meanwhile.
+#define PPG_MOTION_SETTLE 0.25f
+
+// Reference RMS, m/s^2, the step is normalized to at least, see above
+#define PPG_MOTION_MIN_RMS 0.1f
+
+struct ppg_motion_ring
+{
+    uint32_t at[PPG_MOTION_RING]; // Microseconds of uptime, low 32 bits
+    float acc[PPG_MOTION_RING][PPG_MOTION_AXES]; // m/s^2
+    uint32_t count;               // Samples pushed since the reset
+};
+
+struct ppg_motion
+{
+    float mu;      // Step size, 0 .. 2
+    float alpha;   // Tracker coefficient per sample
+    float eps;     // Reference energy floor
+    uint32_t settle;
+    uint32_t n;    // Samples since the reset, up to 'settle'
+
+    float accDc[PPG_MOTION_AXES];
+    float u[PPG_MOTION_AXES][PPG_MOTION_TAPS]; // Reference, newest first
+    float xDc[PPG_MOTION_CHANNELS];
+    float w[PPG_MOTION_CHANNELS][PPG_MOTION_AXES][PPG_MOTION_TAPS];
+};
+
+static inline void ppg_motion_ring_reset(struct ppg_motion_ring *r)
+{
+    r->count = 0;
+}
+
+static inline void ppg_motion_ring_push(
+    struct ppg_motion_ring *r, uint32_t at, const float acc[PPG_MOTION_AXES])
+{
+    uint32_t k = r->count & (PPG_MOTION_RING - 1);
+
+    r->at[k] = at;
+    for (uint8_t a = 0; a < PPG_MOTION_AXES; a++)
+    {
+        r->acc[k][a] = acc[a];
+    }
+    r->count++;
+}
+
+// The acceleration at time 'at', interpolated between the samples either
+// side. False if the ring doesn't reach back to 'at', or 'at' is more than a
+// sample period past the newest sample.
+static inline bool ppg_motion_ring_at(
+    const struct ppg_motion_ring *r, uint32_t at, float acc[PPG_MOTION_AXES])
+{
+    const uint32_t mask = PPG_MOTION_RING - 1;
+    uint32_t held = r->count < PPG_MOTION_RING ? r->count : PPG_MOTION_RING;
+
+    if (held < 2)
+    {
+        return false;
+    }
+
+    // Absolute sample numbers, the timestamps compared as differences so
+    // they can wrap
+    uint32_t lo = r->count - held;
+    uint32_t hi = r->count - 1;
+
+    if ((int32_t)(at - r->at[lo & mask]) < 0)
+    {
+        return false;
+    }
+    if ((int32_t)(at - r->at[hi & mask]) >= 0)
+    {
+        uint32_t period = r->at[hi & mask] - r->at[(hi - 1) & mask];
+
+        if (at - r->at[hi & mask] > period)
+        {
+            return false;
+        }
+        for (uint8_t a = 0; a < PPG_MOTION_AXES; a++)
+        {
+            acc[a] = r->acc[hi & mask][a];
+        }
+        return true;
+    }
+
+    // at[lo] <= at < at[hi]
+    while (hi - lo > 1)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if ((int32_t)(at - r->at[mid & mask]) >= 0)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    uint32_t span = r->at[hi & mask] - r->at[lo & mask];
+    float f = span > 0 ? (float)(at - r->at[lo & mask]) / (float)span : 0.0f;
+
+    for (uint8_t a = 0; a < PPG_MOTION_AXES; a++)
+    {
+        float a0 = r->acc[lo & mask][a];
+
+        acc[a] = a0 + f * (r->acc[hi & mask][a] - a0);
+    }
+    return true;
+}
+
+static inline void ppg_motion_reset(struct ppg_motion *m, float fs, float mu)
+{
+    m->mu = mu;
+    m->alpha = 1.0f - expf(-1.0f / (PPG_MOTION_DC_TAU * fs));
+    m->eps = PPG_MOTION_AXES * PPG_MOTION_TAPS * PPG_MOTION_MIN_RMS * PPG_MOTION_MIN_RMS;
+    m->settle = (uint32_t)(PPG_MOTION_SETTLE * fs + 0.5f);
+    m->n = 0;
+
+    for (uint8_t a = 0; a < PPG_MOTION_AXES; a++)
+    {
+        for (uint8_t k = 0; k < PPG_MOTION_TAPS; k++)
+        {
+            m->u[a][k] = 0.0f;
+        }
+    }
+    for (uint8_t c = 0; c < PPG_MOTION_CHANNELS; c++)
+    {
+        for (uint8_t a = 0; a < PPG_MOTION_AXES; a++)
+        {
+            for (uint8_t k = 0; k < PPG_MOTION_TAPS; k++)
+            {
+                m->w[c][a][k] = 0.0f;
+            }
+        }
+    }
+}
+
+// Take the motion out of the channels of one sample, x[], in place, given the
+// acceleration at the time of the sample (m/s^2)
+static inline void ppg_motion_update(
+    struct ppg_motion *m, const float acc[PPG_MOTION_AXES], float x[PPG_MOTION_CHANNELS])
+{
+    bool settled = m->n >= m->settle;
+    float energy = 0.0f;
+
+    for (uint8_t a = 0; a < PPG_MOTION_AXES; a++)
+    {
+        float *u = m->u[a];
+
+        m->accDc[a] = settled ? m->accDc[a] + m->alpha * (acc[a] - m->accDc[a]) : acc[a];
+
+        for (uint8_t k = PPG_MOTION_TAPS - 1; k > 0; k--)
+        {
+            u[k] = u[k - 1];
+            energy += u[k] * u[k];
+        }
+        u[0] = acc[a] - m->accDc[a];
+        energy += u[0] * u[0];
+    }
+
+    if (!settled)
+    {
+        for (uint8_t c = 0; c < PPG_MOTION_CHANNELS; c++)
+        {
+            m->xDc[c] = x[c];
+        }
+        m->n++;
+        return;
+    }
+
+    for (uint8_t c = 0; c < PPG_MOTION_CHANNELS; c++)
+    {
+        float y = 0.0f;
+
+        for (uint8_t a = 0; a < PPG_MOTION_AXES; a++)
+        {
+            for (uint8_t k = 0; k < PPG_MOTION_TAPS; k++)
+            {
+                y += m->w[c][a][k] * m->u[a][k];
+            }
+        }
+
+        m->xDc[c] += m->alpha * (x[c] - m->xDc[c]);
+
+        // Error without the DC level, which the reference can't explain
+        float step = m->mu * (x[c] - m->xDc[c] - y) / (m->eps + energy);
+
+        for (uint8_t a = 0; a < PPG_MOTION_AXES; a++)
+        {
+            for (uint8_t k = 0; k < PPG_MOTION_TAPS; k++)
+            {
+                m->w[c][a][k] += step * m->u[a][k];
+            }
+        }
+
+        x[c] -= y;
+    }
+}
@@ -0,0 +1,192 @@
+/*
+    Streaming SpO2 and perfusion index from the red and IR channels.
+
+    The signals are split into windows at the beats the heart rate detector
+    finds (src/ppg_hr.h), one cardiac cycle each. Over each window the running
+    sum, minimum and maximum of both channels give the DC level (mean) and the
+    AC amplitude (peak to peak), so a sample costs a few compares and adds and
+    nothing is buffered. At the end of a window the beat's ratio of ratios
+
+        R = (AC red / DC red) / (AC IR / DC IR)
+
+    and perfusion index (AC IR / DC IR, in %) are added up. Once a second of
+    samples has gone by, ppg_spo2_update() reports the averages over the beats
+    that ended in it, and the saturation from the calibration curve
+
+        SpO2 = a R^2 + b R + c
+
+    Below 60 bpm some seconds end no beat, those repeat the previous report
+    for up to PPG_SPO2_HOLD seconds.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Calibration from the MAX30101 reference design, for when the curve of the
+// actual enclosure isn't known. The firmware uses it too, unless
+// CONFIG_APP_PPG_SPO2_CAL gives its own curve.
+#define PPG_SPO2_CAL_A -45.060f
+#define PPG_SPO2_CAL_B 30.354f
+#define PPG_SPO2_CAL_C 94.845f
+
+// Seconds a report is repeated without a new beat
+#define PPG_SPO2_HOLD 3
+
+struct ppg_spo2_cal
+{
+    float a, b, c; // SpO2 % = a R^2 + b R + c
+};
+
+struct ppg_spo2_report
+{
+    uint16_t beats;  // Beats averaged, 0 when repeated
+    float ratio;     // R
+    float perfusion; // Perfusion index, %
+    float spo2;      // %, 0 when there is no reading
+};
+
+struct ppg_spo2_window
+{
+    float sum;
+    float min;
+    float max;
+};
+
+struct ppg_spo2
+{
+    struct ppg_spo2_cal cal;
+    uint32_t period;   // Samples per report
+
+    uint32_t n;        // Samples since the last report
+    bool open;         // A beat started the current window
+    uint32_t count;    // Samples in the current window
+    struct ppg_spo2_window red, ir;
+
+    float ratioSum;    // Over the beats since the last report
+    float perfusionSum;
+    uint16_t beats;
+
+    struct ppg_spo2_report last;
+    uint8_t held;      // Times 'last' was repeated
+};
+
+static inline void ppg_spo2_clear(struct ppg_spo2_report *report)
+{
+    report->beats = 0;
+    report->ratio = 0.0f;
+    report->perfusion = 0.0f;
+    report->spo2 = 0.0f;
+}
+
+static inline void ppg_spo2_reset(
+    struct ppg_spo2 *s, float fs, const struct ppg_spo2_cal *cal)
+{
+    s->cal = *cal;
+    s->period = (uint32_t)(fs + 0.5f);
+    s->n = 0;
+    s->open = false;
+    s->count = 0;
+    s->ratioSum = 0.0f;
+    s->perfusionSum = 0.0f;
+    s->beats = 0;
+    ppg_spo2_clear(&s->last);
+    s->held = 0;
+}
+
+static inline void ppg_spo2_window_add(struct ppg_spo2_window *w, float x, bool first)
+{
+    if (first)
+    {
+        w->sum = x;
+        w->min = x;
+        w->max = x;
+        return;
+    }
+
+    w->sum += x;
+    if (x < w->min)
+    {
+        w->min = x;
+    }
+    if (x > w->max)
+    {
+        w->max = x;
+    }
+}
+
+// Close the window that a beat just ended
+static inline void ppg_spo2_beat(struct ppg_spo2 *s)
+{
+    float dcRed = s->red.sum / s->count;
+    float dcIr = s->ir.sum / s->count;
+    float acRed = s->red.max - s->red.min;
+    float acIr = s->ir.max - s->ir.min;
+
+    // No light coming back, or no pulse in the IR channel
+    if (dcRed <= 0.0f || dcIr <= 0.0f || acIr <= 0.0f)
+    {
+        return;
+    }
+
+    s->ratioSum += (acRed / dcRed) / (acIr / dcIr);
+    s->perfusionSum += 100.0f * acIr / dcIr;
+    s->beats++;
+}
+
+// Feed the next filtered red and IR sample, and whether the beat detector
+// reported a beat at it. Returns true, with the report in *report, once a
+// second.
+static inline bool ppg_spo2_update(
+    struct ppg_spo2 *s, float red, float ir, bool beat,
+    struct ppg_spo2_report *report)
+{
+    if (beat)
+    {
+        if (s->open && s->count > 0)
+        {
+            ppg_spo2_beat(s);
+        }
+        s->open = true;
+        s->count = 0;
+    }
+
+    ppg_spo2_window_add(&s->red, red, s->count == 0);
+    ppg_spo2_window_add(&s->ir, ir, s->count == 0);
+    s->count++;
+
+    if (++s->n < s->period)
+    {
+        return false;
+    }
+
+    if (s->beats > 0)
+    {
+        float r = s->ratioSum / s->beats;
+        float spo2 = (s->cal.a * r + s->cal.b) * r + s->cal.c;
+
+        s->last.beats = s->beats;
+        s->last.ratio = r;
+        s->last.perfusion = s->perfusionSum / s->beats;
+        s->last.spo2 = spo2 > 100.0f ? 100.0f : spo2 < 0.0f ? 0.0f : spo2;
+        s->held = 0;
+    }
+    else if (s->held < PPG_SPO2_HOLD)
+    {
+        s->last.beats = 0;
+        s->held++;
+    }
+    else
+    {
+        ppg_spo2_clear(&s->last);
+    }
+
+    *report = s->last;
+    s->n = 0;
+    s->ratioSum = 0.0f;
+    s->perfusionSum = 0.0f;
+    s->beats = 0;
+
+    return true;
+}
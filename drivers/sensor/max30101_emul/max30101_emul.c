@@ -0,0 +1,605 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/i2c_emul.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#ifdef CONFIG_GPIO_EMUL
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#endif
+
+#include <app/drivers/max30101_emul.h>
+#include <app/drivers/max30101_int.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(max30101_emul, CONFIG_SENSOR_LOG_LEVEL);
+
+#define REG_INT_STS1		0x00
+#define REG_INT_STS2		0x01
+#define REG_INT_EN1		0x02
+#define REG_INT_EN2		0x03
+#define REG_FIFO_WR		0x04
+#define REG_FIFO_OVF		0x05
+#define REG_FIFO_RD		0x06
+#define REG_FIFO_DATA		0x07
+#define REG_FIFO_CFG		0x08
+#define REG_MODE_CFG		0x09
+#define REG_SPO2_CFG		0x0A
+#define REG_LED1_PA		0x0C
+#define REG_PILOT_PA		0x10
+#define REG_MULTI_LED1		0x11
+#define REG_MULTI_LED2		0x12
+#define REG_TEMP_INT		0x1F
+#define REG_TEMP_FRAC		0x20
+#define REG_TEMP_CFG		0x21
+#define REG_REV_ID		0xFE
+#define REG_PART_ID		0xFF
+
+#define INT_A_FULL		BIT(7)
+#define INT_PPG_RDY		BIT(6)
+#define INT_PWR_RDY		BIT(0)
+#define INT_DIE_TEMP_RDY	BIT(1)
+#define FIFO_CFG_ROLLOVER	BIT(4)
+#define FIFO_CFG_A_FULL_MASK	0x0F
+#define MODE_SHDN		BIT(7)
+#define MODE_RESET		BIT(6)
+#define MODE_MASK		0x07
+#define TEMP_EN			BIT(0)
+
+#define PART_ID			0x15
+#define REV_ID			0x03
+#define FIFO_DEPTH		32
+#define FIFO_PTR_MASK		0x1F
+#define OVF_MAX			0x1F
+#define MAX_SLOTS		4
+#define DATA_MASK		0x3FFFF
+#define TEMP_CONVERSION_NS	(29 * NSEC_PER_MSEC)
+
+struct max30101_emul_cfg {
+	uint16_t addr;
+	struct gpio_dt_spec int_gpio;
+};
+
+struct max30101_emul_data {
+	const struct emul *target;
+	struct k_spinlock lock;
+	struct k_timer timer;
+
+	uint8_t reg[256];
+	uint8_t ptr;		/* Register address pointer */
+
+	uint8_t fifo[FIFO_DEPTH][MAX_SLOTS * 3];
+	uint8_t fifo_len[FIFO_DEPTH];
+	uint8_t unread;		/* Records between FIFO_RD and FIFO_WR */
+	uint8_t popped;		/* Bytes of the oldest record already read */
+
+	uint64_t next_ns;	/* When the next record is written */
+	uint32_t period_ns;	/* 0 while not sampling */
+	int32_t clock_ppm;
+
+	bool temp_pending;
+	uint64_t temp_done_ns;
+	int16_t temp;		/* 1/16 degree C */
+
+	const uint32_t (*wave)[3];
+	size_t wave_len;
+	size_t wave_pos;
+
+	uint32_t written;
+	uint32_t lost;
+};
+
+#ifdef MAX30101_EMUL_HAS_WAVEFORM
+/* Built from CONFIG_MAX30101_EMUL_WAVEFORM, see waveform_csv.py */
+static const uint32_t default_wave[][3] = {
+#include "max30101_emul_waveform.inc"
+};
+#endif
+
+/* One period of the synthetic pulse, 1000 * sin() */
+static const int16_t pulse[32] = {
+	0, 195, 383, 556, 707, 831, 924, 981,
+	1000, 981, 924, 831, 707, 556, 383, 195,
+	0, -195, -383, -556, -707, -831, -924, -981,
+	-1000, -981, -924, -831, -707, -556, -383, -195,
+};
+
+static const uint32_t pulse_dc[3] = {120000, 110000, 20000};
+static const uint32_t pulse_ac[3] = {1200, 1500, 800};
+
+static const uint16_t sample_rates[] = {
+	50, 100, 200, 400, 800, 1000, 1600, 3200,
+};
+
+static uint64_t max30101_emul_now(void)
+{
+	return k_ticks_to_ns_floor64(k_uptime_ticks());
+}
+
+/* LED sampled in each active time slot, as the slot code (datasheet pg. 22) */
+static uint8_t max30101_emul_slots(struct max30101_emul_data *data,
+				   uint8_t slots[MAX_SLOTS])
+{
+	uint8_t n = 0;
+
+	switch (data->reg[REG_MODE_CFG] & MODE_MASK) {
+	case 2: /* Heart rate */
+		slots[n++] = 1;
+		break;
+	case 3: /* SpO2 */
+		slots[n++] = 1;
+		slots[n++] = 2;
+		break;
+	case 7: /* Multi-LED, up to the first disabled slot */
+		for (int i = 0; i < MAX_SLOTS; i++) {
+			uint8_t code = data->reg[REG_MULTI_LED1 + i / 2] >>
+				       ((i % 2) * 4) & 0x07;
+
+			if (code == 0) {
+				break;
+			}
+			slots[n++] = code;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return n;
+}
+
+static uint32_t max30101_emul_value(struct max30101_emul_data *data,
+				    uint8_t slot)
+{
+	uint8_t led = (slot - 1) % 3;
+	uint8_t pa = slot <= 3 ? data->reg[REG_LED1_PA + led] :
+				 data->reg[REG_PILOT_PA];
+	uint8_t pulse_width = data->reg[REG_SPO2_CFG] & 0x03;
+	int64_t raw;
+
+	if (data->wave != NULL) {
+		raw = data->wave[data->wave_pos][led];
+	} else {
+		/* 1.2 Hz, 72 beats per minute */
+		uint32_t phase = (data->next_ns * 384 / (10 * NSEC_PER_SEC)) %
+				 ARRAY_SIZE(pulse);
+
+		raw = pulse_dc[led] +
+		      (int64_t)pulse_ac[led] * pulse[phase] / 1000;
+	}
+
+	raw = CLAMP(raw * pa / CONFIG_MAX30101_EMUL_REFERENCE_PA, 0, DATA_MASK);
+
+	/* Shorter pulses resolve fewer bits, the data stays left justified */
+	return (uint32_t)raw & ~BIT_MASK(3 - pulse_width);
+}
+
+/* The sensor writes one record into the FIFO */
+static void max30101_emul_push(struct max30101_emul_data *data)
+{
+	uint8_t slots[MAX_SLOTS];
+	uint8_t n = max30101_emul_slots(data, slots);
+	uint8_t wr = data->reg[REG_FIFO_WR];
+	uint8_t a_full = FIFO_DEPTH -
+			 (data->reg[REG_FIFO_CFG] & FIFO_CFG_A_FULL_MASK);
+
+	data->written++;
+
+	if (data->unread == FIFO_DEPTH) {
+		data->lost++;
+		data->reg[REG_FIFO_OVF] = MIN(data->reg[REG_FIFO_OVF] + 1,
+					      OVF_MAX);
+
+		if ((data->reg[REG_FIFO_CFG] & FIFO_CFG_ROLLOVER) == 0) {
+			/* The FIFO holds on to the old records */
+			goto next;
+		}
+
+		/* The oldest record is overwritten */
+		data->reg[REG_FIFO_RD] = (data->reg[REG_FIFO_RD] + 1) &
+					 FIFO_PTR_MASK;
+		data->unread--;
+		data->popped = 0;
+	}
+
+	for (uint8_t i = 0; i < n; i++) {
+		uint32_t value = max30101_emul_value(data, slots[i]);
+
+		data->fifo[wr][i * 3] = value >> 16;
+		data->fifo[wr][i * 3 + 1] = value >> 8;
+		data->fifo[wr][i * 3 + 2] = value;
+	}
+	data->fifo_len[wr] = n * 3;
+
+	data->reg[REG_FIFO_WR] = (wr + 1) & FIFO_PTR_MASK;
+	data->unread++;
+
+	data->reg[REG_INT_STS1] |= INT_PPG_RDY;
+	if (data->unread == a_full) {
+		data->reg[REG_INT_STS1] |= INT_A_FULL;
+	}
+
+next:
+	if (data->wave != NULL && ++data->wave_pos >= data->wave_len) {
+		data->wave_pos = 0;
+	}
+}
+
+/* Catch up with everything the sensor did until 'now' */
+static void max30101_emul_advance(struct max30101_emul_data *data,
+				  uint64_t now)
+{
+	if (data->temp_pending && now >= data->temp_done_ns) {
+		data->temp_pending = false;
+		data->reg[REG_TEMP_INT] = (uint8_t)(data->temp >> 4);
+		data->reg[REG_TEMP_FRAC] = data->temp & 0x0F;
+		data->reg[REG_TEMP_CFG] &= ~TEMP_EN;
+		data->reg[REG_INT_STS2] |= INT_DIE_TEMP_RDY;
+	}
+
+	if (data->period_ns == 0) {
+		return;
+	}
+
+	while (now >= data->next_ns) {
+		max30101_emul_push(data);
+		data->next_ns += data->period_ns;
+	}
+}
+
+/* INT is open drain and active low, PWR_RDY can't be masked */
+static void max30101_emul_update_int(const struct emul *target)
+{
+#ifdef CONFIG_GPIO_EMUL
+	const struct max30101_emul_cfg *cfg = target->cfg;
+	struct max30101_emul_data *data = target->data;
+	bool active =
+		(data->reg[REG_INT_STS1] &
+		 (data->reg[REG_INT_EN1] | INT_PWR_RDY)) ||
+		(data->reg[REG_INT_STS2] & data->reg[REG_INT_EN2]);
+
+	if (cfg->int_gpio.port != NULL) {
+		gpio_emul_input_set(cfg->int_gpio.port, cfg->int_gpio.pin,
+				    !active);
+	}
+#endif
+}
+
+/* Follow a change of the sampling configuration */
+static void max30101_emul_configure(struct max30101_emul_data *data,
+				    uint64_t now)
+{
+	uint8_t slots[MAX_SLOTS];
+	uint8_t mode = data->reg[REG_MODE_CFG];
+	uint8_t average = 1 << MIN(data->reg[REG_FIFO_CFG] >> 5, 5);
+	uint16_t rate = sample_rates[(data->reg[REG_SPO2_CFG] >> 2) & 0x07];
+	uint32_t period = 0;
+
+	if ((mode & MODE_SHDN) == 0 && max30101_emul_slots(data, slots) > 0) {
+		int64_t nominal = (int64_t)NSEC_PER_SEC * average / rate;
+
+		period = nominal + nominal * data->clock_ppm / 1000000;
+	}
+
+	if (period == data->period_ns) {
+		return;
+	}
+
+	/* A new conversion starts with the new timing */
+	if (data->period_ns == 0 || period == 0 ||
+	    data->next_ns > now + period) {
+		data->next_ns = now + period;
+	}
+	data->period_ns = period;
+
+	if (period == 0) {
+		k_timer_stop(&data->timer);
+	} else {
+		k_timer_start(&data->timer, K_NSEC(data->next_ns - now),
+			      K_NSEC(period));
+	}
+}
+
+static void max30101_emul_reset(struct max30101_emul_data *data)
+{
+	uint8_t status = data->reg[REG_INT_STS1];
+
+	memset(data->reg, 0, sizeof(data->reg));
+	data->reg[REG_INT_STS1] = status & INT_PWR_RDY;
+	data->reg[REG_REV_ID] = REV_ID;
+	data->reg[REG_PART_ID] = PART_ID;
+	data->unread = 0;
+	data->popped = 0;
+	data->temp_pending = false;
+	data->written = 0;
+	data->lost = 0;
+}
+
+static void max30101_emul_timer(struct k_timer *timer)
+{
+	struct max30101_emul_data *data =
+		CONTAINER_OF(timer, struct max30101_emul_data, timer);
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	max30101_emul_advance(data, max30101_emul_now());
+	max30101_emul_update_int(data->target);
+
+	k_spin_unlock(&data->lock, key);
+}
+
+/* Pop one byte, a record leaves the FIFO with its last byte */
+static uint8_t max30101_emul_pop(struct max30101_emul_data *data)
+{
+	uint8_t rd = data->reg[REG_FIFO_RD];
+	uint8_t value;
+
+	if (data->unread == 0) {
+		return 0;
+	}
+
+	value = data->fifo[rd][data->popped++];
+	if (data->popped >= data->fifo_len[rd]) {
+		data->reg[REG_FIFO_RD] = (rd + 1) & FIFO_PTR_MASK;
+		data->reg[REG_FIFO_OVF] = 0;
+		data->unread--;
+		data->popped = 0;
+	}
+
+	return value;
+}
+
+static uint8_t max30101_emul_read_reg(struct max30101_emul_data *data,
+				      uint8_t reg)
+{
+	uint8_t value = data->reg[reg];
+
+	switch (reg) {
+	case REG_INT_STS1:
+	case REG_INT_STS2:
+		/* The only way A_FULL and PPG_RDY clear, reading FIFO_DATA
+		 * leaves them set as on the part
+		 */
+		data->reg[reg] = 0;
+		break;
+	case REG_FIFO_DATA:
+		value = max30101_emul_pop(data);
+		break;
+	case REG_TEMP_FRAC:
+		data->reg[REG_INT_STS2] &= ~INT_DIE_TEMP_RDY;
+		break;
+	default:
+		break;
+	}
+
+	return value;
+}
+
+static void max30101_emul_write_reg(struct max30101_emul_data *data,
+				    uint8_t reg, uint8_t value, uint64_t now)
+{
+	switch (reg) {
+	case REG_INT_STS1:
+	case REG_INT_STS2:
+	case REG_FIFO_DATA:
+	case REG_TEMP_INT:
+	case REG_TEMP_FRAC:
+	case REG_REV_ID:
+	case REG_PART_ID:
+		break; /* Read only */
+	case REG_FIFO_WR:
+	case REG_FIFO_RD:
+		data->reg[reg] = value & FIFO_PTR_MASK;
+		data->unread = (data->reg[REG_FIFO_WR] -
+				data->reg[REG_FIFO_RD]) & FIFO_PTR_MASK;
+		data->popped = 0;
+		break;
+	case REG_FIFO_OVF:
+		data->reg[reg] = value & OVF_MAX;
+		break;
+	case REG_MODE_CFG:
+		if (value & MODE_RESET) {
+			max30101_emul_reset(data);
+		} else {
+			data->reg[reg] = value;
+		}
+		max30101_emul_configure(data, now);
+		break;
+	case REG_FIFO_CFG:
+	case REG_SPO2_CFG:
+	case REG_MULTI_LED1:
+	case REG_MULTI_LED2:
+		data->reg[reg] = value;
+		max30101_emul_configure(data, now);
+		break;
+	case REG_TEMP_CFG:
+		if ((value & TEMP_EN) && !data->temp_pending) {
+			data->temp_pending = true;
+			data->temp_done_ns = now + TEMP_CONVERSION_NS;
+			data->reg[reg] |= TEMP_EN;
+		}
+		break;
+	default:
+		data->reg[reg] = value;
+		break;
+	}
+}
+
+/*
+ * A write message starts with the register address, any further bytes are
+ * written from there on. Reads continue at the register pointer. The pointer
+ * auto-increments, except on FIFO_DATA so a burst drains the FIFO.
+ */
+static int max30101_emul_transfer(const struct emul *target,
+				  struct i2c_msg *msgs, int num_msgs, int addr)
+{
+	const struct max30101_emul_cfg *cfg = target->cfg;
+	struct max30101_emul_data *data = target->data;
+	uint64_t now = max30101_emul_now();
+
+	if (addr != cfg->addr) {
+		return -EIO;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	max30101_emul_advance(data, now);
+
+	for (int m = 0; m < num_msgs; m++) {
+		struct i2c_msg *msg = &msgs[m];
+		uint32_t i = 0;
+
+		if ((msg->flags & I2C_MSG_READ) == 0) {
+			if (msg->len == 0) {
+				continue;
+			}
+			data->ptr = msg->buf[i++];
+		}
+
+		for (; i < msg->len; i++) {
+			if (msg->flags & I2C_MSG_READ) {
+				msg->buf[i] = max30101_emul_read_reg(data,
+								     data->ptr);
+			} else {
+				max30101_emul_write_reg(data, data->ptr,
+							msg->buf[i], now);
+			}
+			if (data->ptr != REG_FIFO_DATA) {
+				data->ptr++;
+			}
+		}
+	}
+
+	max30101_emul_update_int(target);
+
+	k_spin_unlock(&data->lock, key);
+
+	return 0;
+}
+
+static const struct i2c_emul_api max30101_emul_api = {
+	.transfer = max30101_emul_transfer,
+};
+
+void max30101_emul_set_waveform(const struct emul *target,
+				const uint32_t (*samples)[3], size_t count)
+{
+	struct max30101_emul_data *data = target->data;
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	if (samples == NULL || count == 0) {
+#ifdef MAX30101_EMUL_HAS_WAVEFORM
+		samples = default_wave;
+		count = ARRAY_SIZE(default_wave);
+#else
+		samples = NULL;
+		count = 0;
+#endif
+	}
+
+	data->wave = samples;
+	data->wave_len = count;
+	data->wave_pos = 0;
+
+	k_spin_unlock(&data->lock, key);
+}
+
+void max30101_emul_set_clock_ppm(const struct emul *target, int32_t ppm)
+{
+	struct max30101_emul_data *data = target->data;
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+	uint64_t now = max30101_emul_now();
+
+	max30101_emul_advance(data, now);
+	data->clock_ppm = ppm;
+	max30101_emul_configure(data, now);
+
+	k_spin_unlock(&data->lock, key);
+}
+
+void max30101_emul_set_temperature(const struct emul *target,
+				   int16_t sixteenths)
+{
+	struct max30101_emul_data *data = target->data;
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	data->temp = sixteenths;
+
+	k_spin_unlock(&data->lock, key);
+}
+
+void max30101_emul_get_counts(const struct emul *target, uint32_t *written,
+			      uint32_t *lost)
+{
+	struct max30101_emul_data *data = target->data;
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	max30101_emul_advance(data, max30101_emul_now());
+	*written = data->written;
+	*lost = data->lost;
+
+	k_spin_unlock(&data->lock, key);
+}
+
+static int max30101_emul_init(const struct emul *target,
+			      const struct device *parent)
+{
+	const struct max30101_emul_cfg *cfg = target->cfg;
+	struct max30101_emul_data *data = target->data;
+
+	ARG_UNUSED(parent);
+
+	data->target = target;
+	data->temp = 25 * 16;
+	k_timer_init(&data->timer, max30101_emul_timer, NULL);
+
+	/* Power on: registers at their reset values, PWR_RDY raised */
+	max30101_emul_reset(data);
+	data->reg[REG_INT_STS1] = INT_PWR_RDY;
+	max30101_emul_set_waveform(target, NULL, 0);
+
+	if (cfg->int_gpio.port != NULL && !device_is_ready(cfg->int_gpio.port)) {
+		LOG_ERR("INT GPIO not ready");
+		return -ENODEV;
+	}
+
+	max30101_emul_update_int(target);
+
+	return 0;
+}
+
+#define MAX30101_EMUL_DEFINE(name, inst, int_spec)                             \
+	static struct max30101_emul_data name##_emul_data_##inst;             \
+	static const struct max30101_emul_cfg name##_emul_cfg_##inst = {      \
+		.addr = DT_INST_REG_ADDR(inst),                                \
+		.int_gpio = int_spec,                                          \
+	};                                                                     \
+	EMUL_DT_INST_DEFINE(inst, max30101_emul_init,                          \
+			    &name##_emul_data_##inst,                          \
+			    &name##_emul_cfg_##inst, &max30101_emul_api, NULL)
+
+/*
+ * The upstream maxim,max30101 binding has no INT pin, the application wires
+ * it through zephyr,user, see app/drivers/max30101_int.h
+ */
+#define DT_DRV_COMPAT maxim_max30101
+#define MAX30101_EMUL(inst)                                                    \
+	MAX30101_EMUL_DEFINE(max30101, inst,                                   \
+		MAX30101_INT_GPIO_DT_SPEC_GET_OR(DT_DRV_INST(inst), {0}))
+
+DT_INST_FOREACH_STATUS_OKAY(MAX30101_EMUL)
+
+#undef DT_DRV_COMPAT
+#define DT_DRV_COMPAT maxim_max30101_rtio
+#define MAX30101_RTIO_EMUL(inst)                                               \
+	MAX30101_EMUL_DEFINE(max30101_rtio, inst,                              \
+			     GPIO_DT_SPEC_INST_GET_OR(inst, int_gpios, {0}))
+
+DT_INST_FOREACH_STATUS_OKAY(MAX30101_RTIO_EMUL)
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+
+"""Turn a python_data_recoder CSV into a MAX30101 emulator waveform.
+
+The recorder writes one "Sensor,Value" row per channel reading, R, IR and G
+in turn (older recordings label them b'R', b'IR' and b'G'). The output is a
+list of {red, ir, green} C initialisers, one per FIFO record, clamped to the
+18 bit ADC range.
+"""
+
+import argparse
+import csv
+
+CHANNELS = {"R": 0, "IR": 1, "G": 2}
+DATA_MAX = (1 << 18) - 1
+
+
+def read_channels(path):
+    channels = ([], [], [])
+
+    with open(path, newline="") as f:
+        for row in csv.reader(f):
+            if len(row) < 2:
+                continue
+            label = row[0].strip()
+            if label.startswith("b'") and label.endswith("'"):
+                label = label[2:-1]
+            if label not in CHANNELS:
+                continue  # Header and anything the recorder did not tag
+            try:
+                value = round(float(row[1]))
+            except ValueError:
+                continue
+            channels[CHANNELS[label]].append(min(max(value, 0), DATA_MAX))
+
+    return channels
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("csv", help="recording to play back")
+    parser.add_argument("output", help="C include file to write")
+    args = parser.parse_args()
+
+    red, ir, green = read_channels(args.csv)
+    count = min(len(red), len(ir), len(green))
+    if count == 0:
+        parser.error(f"{args.csv}: no R, IR and G readings")
+
+    with open(args.output, "w") as f:
+        f.write(f"/* Generated from {args.csv}, {count} records */\n")
+        for i in range(count):
+            f.write(f"{{{red[i]}, {ir[i]}, {green[i]}}},\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,377 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define DT_DRV_COMPAT maxim_max30101_rtio
+
+#include <string.h>
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/rtio/rtio.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(max30101_rtio, CONFIG_SENSOR_LOG_LEVEL);
+
+#include "max30101_rtio.h"
+
+#define RESET_TIMEOUT_MS 100
+#define WRITE_MAX 3
+
+static const uint8_t slot_chan[] = {
+	[1] = SENSOR_CHAN_RED,
+	[2] = SENSOR_CHAN_IR,
+	[3] = SENSOR_CHAN_GREEN,
+};
+
+int max30101_rtio_read_state(const struct device *dev, uint8_t *count,
+			     uint8_t *lost)
+{
+	const struct max30101_rtio_config *config = dev->config;
+	uint8_t state[3];
+	int rc;
+
+	/* FIFO_WR_PTR, OVF_COUNTER and FIFO_RD_PTR in one transfer */
+	rc = i2c_burst_read_dt(&config->i2c, MAX30101_REG_FIFO_WR, state,
+			       sizeof(state));
+	if (rc < 0) {
+		return rc;
+	}
+
+	*lost = state[1] & MAX30101_FIFO_PTR_MASK;
+	*count = (state[0] - state[2]) & MAX30101_FIFO_PTR_MASK;
+
+	/* Equal pointers mean empty, unless it rolled over */
+	if (*count == 0 && *lost > 0) {
+		*count = MAX30101_FIFO_DEPTH;
+	}
+
+	return 0;
+}
+
+/*
+ * Consecutive registers in a single message, not every controller can send
+ * i2c_burst_write()'s two write messages back to back
+ */
+static int max30101_write(const struct device *dev, uint8_t reg,
+			  const uint8_t *data, uint8_t len)
+{
+	const struct max30101_rtio_config *config = dev->config;
+	uint8_t buf[1 + WRITE_MAX];
+
+	__ASSERT_NO_MSG(len <= WRITE_MAX);
+
+	buf[0] = reg;
+	memcpy(&buf[1], data, len);
+
+	return i2c_write_dt(&config->i2c, buf, 1 + len);
+}
+
+int max30101_rtio_clear_fifo(const struct device *dev)
+{
+	const uint8_t zero[3] = {0};
+
+	return max30101_write(dev, MAX30101_REG_FIFO_WR, zero, sizeof(zero));
+}
+
+void max30101_rtio_encode_header(const struct device *dev,
+				 struct max30101_rtio_encoded_data *edata,
+				 uint8_t count, uint8_t lost)
+{
+	const struct max30101_rtio_config *config = dev->config;
+
+	edata->timestamp = k_ticks_to_ns_floor64(k_uptime_ticks());
+	edata->period_ns = config->period_ns;
+	edata->num_chan = config->num_slots;
+	for (uint8_t i = 0; i < config->num_slots; i++) {
+		edata->chan[i] = slot_chan[config->slots[i]];
+	}
+	edata->count = count;
+	edata->lost = lost;
+	edata->fifo_watermark = 0;
+	edata->fifo_full = 0;
+}
+
+static void max30101_submit_one_shot(const struct device *dev,
+				     struct rtio_iodev_sqe *iodev_sqe)
+{
+	const struct max30101_rtio_config *config = dev->config;
+	struct max30101_rtio_encoded_data *edata;
+	uint8_t *buf;
+	uint32_t buf_len;
+	uint8_t count, lost;
+	int rc;
+
+	rc = max30101_rtio_read_state(dev, &count, &lost);
+	if (rc < 0) {
+		LOG_ERR("Could not read FIFO state (%d)", rc);
+		rtio_iodev_sqe_err(iodev_sqe, rc);
+		return;
+	}
+
+	/* Everything pending, straight from the bus into the RTIO buffer */
+	uint32_t size = count * config->num_slots * MAX30101_WORD_SIZE;
+	uint32_t min_len = sizeof(*edata) + size;
+
+	rc = rtio_sqe_rx_buf(iodev_sqe, min_len, min_len, &buf, &buf_len);
+	if (rc < 0) {
+		LOG_ERR("Could not get a %u byte buffer (%d)", min_len, rc);
+		rtio_iodev_sqe_err(iodev_sqe, rc);
+		return;
+	}
+
+	edata = (struct max30101_rtio_encoded_data *)buf;
+	max30101_rtio_encode_header(dev, edata, count, lost);
+
+	if (size > 0) {
+		rc = i2c_burst_read_dt(&config->i2c, MAX30101_REG_FIFO_DATA,
+				       edata->fifo, size);
+		if (rc < 0) {
+			LOG_ERR("Could not read FIFO (%d)", rc);
+			rtio_iodev_sqe_err(iodev_sqe, rc);
+			return;
+		}
+	}
+
+	rtio_iodev_sqe_ok(iodev_sqe, 0);
+}
+
+static void max30101_submit(const struct device *dev,
+			    struct rtio_iodev_sqe *iodev_sqe)
+{
+	const struct sensor_read_config *cfg = iodev_sqe->sqe.iodev->data;
+
+	if (!cfg->is_streaming) {
+		max30101_submit_one_shot(dev, iodev_sqe);
+		return;
+	}
+
+#ifdef CONFIG_MAX30101_RTIO_STREAM
+	max30101_rtio_submit_stream(dev, iodev_sqe);
+#else
+	rtio_iodev_sqe_err(iodev_sqe, -ENOTSUP);
+#endif
+}
+
+static int max30101_sample_fetch(const struct device *dev,
+				 enum sensor_channel chan)
+{
+	const struct max30101_rtio_config *config = dev->config;
+	struct max30101_rtio_data *data = dev->data;
+	uint8_t record[MAX30101_MAX_CHANNELS * MAX30101_WORD_SIZE];
+	uint8_t wr_ptr;
+	int rc;
+
+	rc = i2c_reg_read_byte_dt(&config->i2c, MAX30101_REG_FIFO_WR, &wr_ptr);
+	if (rc < 0) {
+		return rc;
+	}
+
+	/* Skip to the newest record instead of draining the FIFO */
+	rc = i2c_reg_write_byte_dt(&config->i2c, MAX30101_REG_FIFO_RD,
+				   (wr_ptr - 1) & MAX30101_FIFO_PTR_MASK);
+	if (rc < 0) {
+		return rc;
+	}
+
+	rc = i2c_burst_read_dt(&config->i2c, MAX30101_REG_FIFO_DATA, record,
+			       config->num_slots * MAX30101_WORD_SIZE);
+	if (rc < 0) {
+		return rc;
+	}
+
+	for (uint8_t i = 0; i < config->num_slots; i++) {
+		const uint8_t *p = &record[i * MAX30101_WORD_SIZE];
+
+		data->sample[i] = ((p[0] << 16) | (p[1] << 8) | p[2]) &
+				  MAX30101_DATA_MASK;
+	}
+
+	return 0;
+}
+
+static int max30101_channel_get(const struct device *dev,
+				enum sensor_channel chan,
+				struct sensor_value *val)
+{
+	const struct max30101_rtio_config *config = dev->config;
+	struct max30101_rtio_data *data = dev->data;
+
+	for (uint8_t i = 0; i < config->num_slots; i++) {
+		if (slot_chan[config->slots[i]] == chan) {
+			val->val1 = data->sample[i];
+			val->val2 = 0;
+			return 0;
+		}
+	}
+
+	return -ENOTSUP;
+}
+
+static const struct sensor_driver_api max30101_api = {
+	.sample_fetch = max30101_sample_fetch,
+	.channel_get = max30101_channel_get,
+	.get_decoder = max30101_rtio_get_decoder,
+	.submit = max30101_submit,
+};
+
+static int max30101_reset(const struct device *dev)
+{
+	const struct max30101_rtio_config *config = dev->config;
+	uint8_t mode;
+	int rc;
+
+	rc = i2c_reg_write_byte_dt(&config->i2c, MAX30101_REG_MODE_CFG,
+				   MAX30101_MODE_RESET);
+	if (rc < 0) {
+		return rc;
+	}
+
+	for (int i = 0; i < RESET_TIMEOUT_MS; i++) {
+		k_msleep(1);
+
+		rc = i2c_reg_read_byte_dt(&config->i2c, MAX30101_REG_MODE_CFG,
+					  &mode);
+		if (rc < 0) {
+			return rc;
+		}
+		if ((mode & MAX30101_MODE_RESET) == 0) {
+			return 0;
+		}
+	}
+
+	return -ETIMEDOUT;
+}
+
+static int max30101_init(const struct device *dev)
+{
+	const struct max30101_rtio_config *config = dev->config;
+	uint8_t part_id = 0;
+	int rc;
+
+	if (!i2c_is_ready_dt(&config->i2c)) {
+		LOG_ERR("I2C bus not ready");
+		return -ENODEV;
+	}
+
+	rc = i2c_reg_read_byte_dt(&config->i2c, MAX30101_REG_PART_ID, &part_id);
+	if (rc < 0 || part_id != MAX30101_PART_ID) {
+		LOG_ERR("Part ID 0x%02x, not a MAX30101 (%d)", part_id, rc);
+		return -ENODEV;
+	}
+
+	rc = max30101_reset(dev);
+	if (rc < 0) {
+		LOG_ERR("Could not reset (%d)", rc);
+		return rc;
+	}
+
+	/* FIFO_CONFIG to SPO2_CONFIG, the watermark applies to streaming */
+	const uint8_t cfg[] = {
+		config->fifo_cfg |
+			(MAX30101_FIFO_DEPTH - config->watermark),
+		MAX30101_MODE_MULTI_LED,
+		config->spo2_cfg,
+	};
+	uint8_t slots[2] = {
+		config->slots[0] | (config->slots[1] << 4),
+		config->slots[2],
+	};
+
+	rc = max30101_write(dev, MAX30101_REG_FIFO_CFG, cfg, sizeof(cfg));
+	if (rc == 0) {
+		rc = max30101_write(dev, MAX30101_REG_LED1_PA, config->led_pa,
+				    sizeof(config->led_pa));
+	}
+	if (rc == 0) {
+		rc = max30101_write(dev, MAX30101_REG_MULTI_LED, slots,
+				    sizeof(slots));
+	}
+	if (rc == 0) {
+		rc = max30101_rtio_clear_fifo(dev);
+	}
+	if (rc < 0) {
+		LOG_ERR("Could not configure (%d)", rc);
+		return rc;
+	}
+
+#ifdef CONFIG_MAX30101_RTIO_STREAM
+	rc = max30101_rtio_stream_init(dev);
+	if (rc < 0) {
+		return rc;
+	}
+#endif
+
+	return 0;
+}
+
+#define MAX30101_SLOT_OR_NONE(i, n)					       \
+	COND_CODE_1(DT_INST_PROP_HAS_IDX(i, led_slots, n),		       \
+		    (DT_INST_PROP_BY_IDX(i, led_slots, n)), (0))
+
+/* Slot n is 1 (red), 2 (IR) or 3 (green), or not there */
+#define MAX30101_SLOT_VALID(i, n)					       \
+	COND_CODE_1(DT_INST_PROP_HAS_IDX(i, led_slots, n),		       \
+		    (DT_INST_PROP_BY_IDX(i, led_slots, n) >= 1 &&	       \
+		     DT_INST_PROP_BY_IDX(i, led_slots, n) <= 3), (1))
+
+/* Slots n and m hold different LEDs, or aren't both there */
+#define MAX30101_SLOTS_DIFFER(i, n, m)					       \
+	(MAX30101_SLOT_OR_NONE(i, n) == 0 ||				       \
+	 MAX30101_SLOT_OR_NONE(i, n) != MAX30101_SLOT_OR_NONE(i, m))
+
+#ifdef CONFIG_MAX30101_RTIO_STREAM
+#define MAX30101_INT_GPIO(i)						       \
+	.int_gpio = GPIO_DT_SPEC_INST_GET_OR(i, int_gpios, {0}),
+#else
+#define MAX30101_INT_GPIO(i)
+#endif
+
+#define MAX30101_RTIO_INIT(i)						       \
+	BUILD_ASSERT(DT_INST_PROP_LEN(i, led_slots) >= 1 &&		       \
+		     DT_INST_PROP_LEN(i, led_slots) <= MAX30101_MAX_CHANNELS,  \
+		     "One to three LED slots");				       \
+	BUILD_ASSERT(MAX30101_SLOT_VALID(i, 0) &&			       \
+		     MAX30101_SLOT_VALID(i, 1) &&			       \
+		     MAX30101_SLOT_VALID(i, 2),				       \
+		     "LED slots must be 1 (red), 2 (IR) or 3 (green)");	       \
+	BUILD_ASSERT(MAX30101_SLOTS_DIFFER(i, 0, 1) &&			       \
+		     MAX30101_SLOTS_DIFFER(i, 0, 2) &&			       \
+		     MAX30101_SLOTS_DIFFER(i, 1, 2),			       \
+		     "Each LED in at most one slot");			       \
+	BUILD_ASSERT(DT_INST_PROP(i, fifo_watermark) >= 17 &&		       \
+		     DT_INST_PROP(i, fifo_watermark) <= 31,		       \
+		     "FIFO watermark must be 17 to 31");		       \
+									       \
+	static struct max30101_rtio_data max30101_rtio_data_##i;	       \
+									       \
+	static const struct max30101_rtio_config max30101_rtio_config_##i = { \
+		.i2c = I2C_DT_SPEC_INST_GET(i),				       \
+		MAX30101_INT_GPIO(i)					       \
+		.fifo_cfg = (DT_INST_ENUM_IDX(i, sample_average) << 5) |      \
+			    MAX30101_FIFO_CFG_ROLLOVER,			       \
+		.spo2_cfg = (DT_INST_ENUM_IDX(i, adc_range) << 5) |	       \
+			    (DT_INST_ENUM_IDX(i, sample_rate) << 2) |	       \
+			    DT_INST_ENUM_IDX(i, pulse_width),		       \
+		.led_pa = DT_INST_PROP(i, led_pa),			       \
+		.slots = {						       \
+			MAX30101_SLOT_OR_NONE(i, 0),			       \
+			MAX30101_SLOT_OR_NONE(i, 1),			       \
+			MAX30101_SLOT_OR_NONE(i, 2),			       \
+		},							       \
+		.num_slots = DT_INST_PROP_LEN(i, led_slots),		       \
+		.watermark = DT_INST_PROP(i, fifo_watermark),		       \
+		.period_ns = (uint32_t)(1000000000ULL *			       \
+					DT_INST_PROP(i, sample_average) /      \
+					DT_INST_PROP(i, sample_rate)),	       \
+	};								       \
+									       \
+	SENSOR_DEVICE_DT_INST_DEFINE(i, max30101_init, NULL,		       \
+				     &max30101_rtio_data_##i,		       \
+				     &max30101_rtio_config_##i, POST_KERNEL,   \
+				     CONFIG_SENSOR_INIT_PRIORITY,	       \
+				     &max30101_api);
+
+DT_INST_FOREACH_STATUS_OKAY(MAX30101_RTIO_INIT)
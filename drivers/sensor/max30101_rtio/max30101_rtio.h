@@ -0,0 +1,101 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_DRIVERS_SENSOR_MAX30101_RTIO_H_
+#define APP_DRIVERS_SENSOR_MAX30101_RTIO_H_
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/rtio/rtio.h>
+
+#define MAX30101_REG_INT_STS1		0x00
+#define MAX30101_REG_INT_EN1		0x02
+#define MAX30101_REG_FIFO_WR		0x04
+#define MAX30101_REG_FIFO_OVF		0x05
+#define MAX30101_REG_FIFO_RD		0x06
+#define MAX30101_REG_FIFO_DATA		0x07
+#define MAX30101_REG_FIFO_CFG		0x08
+#define MAX30101_REG_MODE_CFG		0x09
+#define MAX30101_REG_SPO2_CFG		0x0A
+#define MAX30101_REG_LED1_PA		0x0C
+#define MAX30101_REG_MULTI_LED		0x11
+#define MAX30101_REG_PART_ID		0xFF
+
+#define MAX30101_INT_A_FULL		BIT(7)
+#define MAX30101_FIFO_CFG_ROLLOVER	BIT(4)
+#define MAX30101_FIFO_CFG_A_FULL_MASK	0x0F
+#define MAX30101_MODE_RESET		BIT(6)
+#define MAX30101_MODE_MULTI_LED		0x07
+#define MAX30101_PART_ID		0x15
+
+#define MAX30101_FIFO_DEPTH		32
+#define MAX30101_FIFO_PTR_MASK		0x1F
+#define MAX30101_MAX_CHANNELS		3
+#define MAX30101_WORD_SIZE		3
+#define MAX30101_DATA_MASK		0x3FFFF
+/* 18 bit ADC counts, as q31 with this shift */
+#define MAX30101_Q31_SHIFT		18
+
+struct max30101_rtio_config {
+	struct i2c_dt_spec i2c;
+#ifdef CONFIG_MAX30101_RTIO_STREAM
+	struct gpio_dt_spec int_gpio;
+#endif
+	uint8_t fifo_cfg;	/* FIFO_CONFIG, A_FULL left clear */
+	uint8_t spo2_cfg;
+	uint8_t led_pa[MAX30101_MAX_CHANNELS];
+	uint8_t slots[MAX30101_MAX_CHANNELS];
+	uint8_t num_slots;
+	uint8_t watermark;
+	uint32_t period_ns;	/* FIFO record period */
+};
+
+struct max30101_rtio_data {
+	/* Last record read by sample_fetch(), in slot order */
+	uint32_t sample[MAX30101_MAX_CHANNELS];
+#ifdef CONFIG_MAX30101_RTIO_STREAM
+	const struct device *dev;
+	struct gpio_callback int_cb;
+	struct k_work int_work;
+	struct rtio_iodev_sqe *streaming_sqe;
+	uint8_t int_en;		/* INT_ENABLE_1 the current stream needs */
+	uint8_t watermark;	/* Watermark the current stream needs */
+#endif
+};
+
+/*
+ * Layout of a sensor_read() / sensor_stream() buffer. The FIFO records go
+ * from the bus straight into fifo[], the decoder unpacks them.
+ */
+struct max30101_rtio_encoded_data {
+	uint64_t timestamp;	/* ns, when the newest record was read */
+	uint32_t period_ns;
+	uint8_t chan[MAX30101_MAX_CHANNELS]; /* enum sensor_channel per word */
+	uint8_t num_chan;
+	uint8_t count;		/* Records in fifo[] */
+	uint8_t lost;		/* OVF_COUNTER, records lost before fifo[0] */
+	uint8_t fifo_watermark: 1;
+	uint8_t fifo_full: 1;
+	uint8_t fifo[];
+};
+
+int max30101_rtio_read_state(const struct device *dev, uint8_t *count,
+			     uint8_t *lost);
+int max30101_rtio_clear_fifo(const struct device *dev);
+void max30101_rtio_encode_header(const struct device *dev,
+				 struct max30101_rtio_encoded_data *edata,
+				 uint8_t count, uint8_t lost);
+
+int max30101_rtio_get_decoder(const struct device *dev,
+			      const struct sensor_decoder_api **decoder);
+
+#ifdef CONFIG_MAX30101_RTIO_STREAM
+int max30101_rtio_stream_init(const struct device *dev);
+void max30101_rtio_submit_stream(const struct device *dev,
+				 struct rtio_iodev_sqe *iodev_sqe);
+#endif
+
+#endif /* APP_DRIVERS_SENSOR_MAX30101_RTIO_H_ */
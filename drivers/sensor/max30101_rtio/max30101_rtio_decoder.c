@@ -0,0 +1,141 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define DT_DRV_COMPAT maxim_max30101_rtio
+
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/drivers/sensor_data_types.h>
+
+#include "max30101_rtio.h"
+
+/* Word index of a channel in each FIFO record, -1 if it is not sampled */
+static int max30101_word(const struct max30101_rtio_encoded_data *edata,
+			 struct sensor_chan_spec chan_spec)
+{
+	if (chan_spec.chan_idx != 0) {
+		return -1;
+	}
+
+	for (int i = 0; i < edata->num_chan; i++) {
+		if (edata->chan[i] == chan_spec.chan_type) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static int max30101_decoder_get_frame_count(const uint8_t *buffer,
+					    struct sensor_chan_spec chan_spec,
+					    uint16_t *frame_count)
+{
+	const struct max30101_rtio_encoded_data *edata =
+		(const struct max30101_rtio_encoded_data *)buffer;
+
+	if (max30101_word(edata, chan_spec) < 0) {
+		return -ENOTSUP;
+	}
+
+	*frame_count = edata->count;
+
+	return 0;
+}
+
+static int max30101_decoder_get_size_info(struct sensor_chan_spec chan_spec,
+					  size_t *base_size, size_t *frame_size)
+{
+	switch (chan_spec.chan_type) {
+	case SENSOR_CHAN_RED:
+	case SENSOR_CHAN_IR:
+	case SENSOR_CHAN_GREEN:
+		*base_size = sizeof(struct sensor_q31_data);
+		*frame_size = sizeof(struct sensor_q31_sample_data);
+		return 0;
+	default:
+		return -ENOTSUP;
+	}
+}
+
+/*
+ * Records are evenly spaced, the last one was written just before the FIFO
+ * was read. Frames come out oldest first as 18 bit ADC counts.
+ */
+static int max30101_decoder_decode(const uint8_t *buffer,
+				   struct sensor_chan_spec chan_spec,
+				   uint32_t *fit, uint16_t max_count,
+				   void *data_out)
+{
+	const struct max30101_rtio_encoded_data *edata =
+		(const struct max30101_rtio_encoded_data *)buffer;
+	struct sensor_q31_data *out = data_out;
+	int word = max30101_word(edata, chan_spec);
+
+	if (word < 0) {
+		return -ENOTSUP;
+	}
+
+	if (*fit >= edata->count) {
+		return 0;
+	}
+
+	/* Keep every timestamp_delta within 32 bits at the slowest rates */
+	uint32_t first = *fit;
+	uint32_t count = MIN(max_count, edata->count - first);
+
+	count = MIN(count, UINT32_MAX / edata->period_ns + 1);
+
+	out->header.base_timestamp_ns =
+		edata->timestamp -
+		(uint64_t)(edata->count - 1 - first) * edata->period_ns;
+	out->header.reading_count = count;
+	out->shift = MAX30101_Q31_SHIFT;
+
+	const uint8_t record_size = edata->num_chan * MAX30101_WORD_SIZE;
+	const uint8_t *p = &edata->fifo[first * record_size +
+					word * MAX30101_WORD_SIZE];
+
+	for (uint32_t i = 0; i < count; i++, p += record_size) {
+		uint32_t raw = ((p[0] << 16) | (p[1] << 8) | p[2]) &
+			       MAX30101_DATA_MASK;
+
+		out->readings[i].timestamp_delta = i * edata->period_ns;
+		out->readings[i].value = raw << (31 - MAX30101_Q31_SHIFT);
+	}
+
+	*fit = first + count;
+
+	return count;
+}
+
+static bool max30101_decoder_has_trigger(const uint8_t *buffer,
+					 enum sensor_trigger_type trigger)
+{
+	const struct max30101_rtio_encoded_data *edata =
+		(const struct max30101_rtio_encoded_data *)buffer;
+
+	switch (trigger) {
+	case SENSOR_TRIG_FIFO_WATERMARK:
+		return edata->fifo_watermark;
+	case SENSOR_TRIG_FIFO_FULL:
+		return edata->fifo_full;
+	default:
+		return false;
+	}
+}
+
+SENSOR_DECODER_API_DT_DEFINE() = {
+	.get_frame_count = max30101_decoder_get_frame_count,
+	.get_size_info = max30101_decoder_get_size_info,
+	.decode = max30101_decoder_decode,
+	.has_trigger = max30101_decoder_has_trigger,
+};
+
+int max30101_rtio_get_decoder(const struct device *dev,
+			      const struct sensor_decoder_api **decoder)
+{
+	ARG_UNUSED(dev);
+	*decoder = &SENSOR_DECODER_NAME();
+
+	return 0;
+}
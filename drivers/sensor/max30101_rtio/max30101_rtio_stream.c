@@ -0,0 +1,256 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/rtio/rtio.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_DECLARE(max30101_rtio, CONFIG_SENSOR_LOG_LEVEL);
+
+#include "max30101_rtio.h"
+
+/*
+ * The MAX30101 only has an almost full interrupt (A_FULL). The watermark
+ * trigger programs it at the devicetree watermark, the full trigger alone
+ * one record short of full: at 32 unread records the pointers are equal and
+ * the FIFO reads as empty until it rolls over. Full is reported once records
+ * have been lost (OVF_COUNTER) or the watermark was left far behind.
+ */
+#define FULL_WATERMARK (MAX30101_FIFO_DEPTH - 1)
+
+static void max30101_int_handler(const struct device *port,
+				 struct gpio_callback *cb, uint32_t pins)
+{
+	struct max30101_rtio_data *data =
+		CONTAINER_OF(cb, struct max30101_rtio_data, int_cb);
+
+	/* I2C can't run here, the work item reads the FIFO */
+	k_work_submit(&data->int_work);
+}
+
+static void max30101_int_work_handler(struct k_work *work)
+{
+	struct max30101_rtio_data *data =
+		CONTAINER_OF(work, struct max30101_rtio_data, int_work);
+	const struct device *dev = data->dev;
+	const struct max30101_rtio_config *config = dev->config;
+	struct rtio_iodev_sqe *iodev_sqe = data->streaming_sqe;
+	struct max30101_rtio_encoded_data *edata;
+	uint8_t status, count, lost;
+	uint8_t *buf;
+	uint32_t buf_len;
+	int rc;
+
+	/* Reading the status releases INT */
+	rc = i2c_reg_read_byte_dt(&config->i2c, MAX30101_REG_INT_STS1, &status);
+	if (rc == 0) {
+		rc = max30101_rtio_read_state(dev, &count, &lost);
+	}
+	if (rc < 0) {
+		LOG_ERR("Could not read FIFO state (%d)", rc);
+		if (iodev_sqe != NULL) {
+			data->streaming_sqe = NULL;
+			rtio_iodev_sqe_err(iodev_sqe, rc);
+		}
+		return;
+	}
+
+	if ((status & MAX30101_INT_A_FULL) == 0) {
+		return;
+	}
+
+	if (iodev_sqe == NULL) {
+		/* Nobody to hand the data to, drop it so A_FULL fires again */
+		max30101_rtio_clear_fifo(dev);
+		return;
+	}
+
+	const struct sensor_read_config *read_cfg = iodev_sqe->sqe.iodev->data;
+	bool watermark = count >= data->watermark;
+	bool full = lost > 0 || count >= FULL_WATERMARK;
+	enum sensor_stream_data_opt opt = SENSOR_STREAM_DATA_NOP;
+	bool fired = false;
+
+	/* Include wins over drop, drop over nop */
+	for (size_t i = 0; i < read_cfg->count; i++) {
+		const struct sensor_stream_trigger *trig = &read_cfg->triggers[i];
+
+		if ((trig->trigger == SENSOR_TRIG_FIFO_WATERMARK && watermark) ||
+		    (trig->trigger == SENSOR_TRIG_FIFO_FULL && full)) {
+			if (!fired || trig->opt == SENSOR_STREAM_DATA_INCLUDE ||
+			    (trig->opt == SENSOR_STREAM_DATA_DROP &&
+			     opt == SENSOR_STREAM_DATA_NOP)) {
+				opt = trig->opt;
+			}
+			fired = true;
+		}
+	}
+
+	if (!fired) {
+		return;
+	}
+
+	uint32_t size = 0;
+
+	if (opt == SENSOR_STREAM_DATA_INCLUDE) {
+		size = count * config->num_slots * MAX30101_WORD_SIZE;
+	}
+
+	uint32_t min_len = sizeof(*edata) + size;
+
+	data->streaming_sqe = NULL;
+
+	rc = rtio_sqe_rx_buf(iodev_sqe, min_len, min_len, &buf, &buf_len);
+	if (rc < 0) {
+		LOG_ERR("Could not get a %u byte buffer (%d)", min_len, rc);
+		max30101_rtio_clear_fifo(dev);
+		rtio_iodev_sqe_err(iodev_sqe, rc);
+		return;
+	}
+
+	edata = (struct max30101_rtio_encoded_data *)buf;
+	max30101_rtio_encode_header(dev, edata, size ? count : 0, lost);
+	edata->fifo_watermark = watermark;
+	edata->fifo_full = full;
+
+	if (size > 0) {
+		/* Zero-copy: the bus fills the consumer's buffer directly */
+		rc = i2c_burst_read_dt(&config->i2c, MAX30101_REG_FIFO_DATA,
+				       edata->fifo, size);
+	} else if (opt == SENSOR_STREAM_DATA_DROP) {
+		rc = max30101_rtio_clear_fifo(dev);
+	}
+
+	if (rc < 0) {
+		LOG_ERR("Could not read FIFO (%d)", rc);
+		rtio_iodev_sqe_err(iodev_sqe, rc);
+		return;
+	}
+
+	/* A multishot read is resubmitted from in here */
+	rtio_iodev_sqe_ok(iodev_sqe, 0);
+}
+
+static int max30101_arm(const struct device *dev, uint8_t int_en,
+			uint8_t watermark)
+{
+	const struct max30101_rtio_config *config = dev->config;
+	struct max30101_rtio_data *data = dev->data;
+	uint8_t status;
+	int rc;
+
+	rc = gpio_pin_interrupt_configure_dt(&config->int_gpio,
+					     GPIO_INT_DISABLE);
+	if (rc < 0) {
+		return rc;
+	}
+
+	rc = i2c_reg_write_byte_dt(&config->i2c, MAX30101_REG_FIFO_CFG,
+				   config->fifo_cfg |
+				   (MAX30101_FIFO_DEPTH - watermark));
+	if (rc == 0) {
+		rc = i2c_reg_write_byte_dt(&config->i2c, MAX30101_REG_INT_EN1,
+					   int_en);
+	}
+	if (rc == 0) {
+		/* INT may already be low, an edge would then never come */
+		rc = i2c_reg_read_byte_dt(&config->i2c, MAX30101_REG_INT_STS1,
+					  &status);
+	}
+	if (rc < 0) {
+		return rc;
+	}
+
+	data->int_en = int_en;
+	data->watermark = watermark;
+
+	if (int_en == 0) {
+		return 0;
+	}
+
+	return gpio_pin_interrupt_configure_dt(&config->int_gpio,
+					       GPIO_INT_EDGE_TO_ACTIVE);
+}
+
+void max30101_rtio_submit_stream(const struct device *dev,
+				 struct rtio_iodev_sqe *iodev_sqe)
+{
+	const struct sensor_read_config *read_cfg = iodev_sqe->sqe.iodev->data;
+	const struct max30101_rtio_config *config = dev->config;
+	struct max30101_rtio_data *data = dev->data;
+	uint8_t watermark = FULL_WATERMARK;
+	int rc;
+
+	if (config->int_gpio.port == NULL) {
+		rtio_iodev_sqe_err(iodev_sqe, -ENOTSUP);
+		return;
+	}
+
+	for (size_t i = 0; i < read_cfg->count; i++) {
+		switch (read_cfg->triggers[i].trigger) {
+		case SENSOR_TRIG_FIFO_WATERMARK:
+			watermark = config->watermark;
+			break;
+		case SENSOR_TRIG_FIFO_FULL:
+			break;
+		default:
+			LOG_ERR("Trigger %d not supported",
+				read_cfg->triggers[i].trigger);
+			rtio_iodev_sqe_err(iodev_sqe, -ENOTSUP);
+			return;
+		}
+	}
+
+	/* Only touch the sensor when the stream changes, not on every rearm */
+	if (data->int_en != MAX30101_INT_A_FULL ||
+	    data->watermark != watermark) {
+		rc = max30101_arm(dev, MAX30101_INT_A_FULL, watermark);
+		if (rc < 0) {
+			LOG_ERR("Could not arm the FIFO interrupt (%d)", rc);
+			rtio_iodev_sqe_err(iodev_sqe, rc);
+			return;
+		}
+	}
+
+	data->streaming_sqe = iodev_sqe;
+}
+
+int max30101_rtio_stream_init(const struct device *dev)
+{
+	const struct max30101_rtio_config *config = dev->config;
+	struct max30101_rtio_data *data = dev->data;
+	int rc;
+
+	data->dev = dev;
+	k_work_init(&data->int_work, max30101_int_work_handler);
+
+	if (config->int_gpio.port == NULL) {
+		return 0; /* Streaming is refused, one-shot reads still work */
+	}
+
+	if (!gpio_is_ready_dt(&config->int_gpio)) {
+		LOG_ERR("INT GPIO not ready");
+		return -ENODEV;
+	}
+
+	rc = gpio_pin_configure_dt(&config->int_gpio, GPIO_INPUT);
+	if (rc < 0) {
+		LOG_ERR("Could not configure INT GPIO (%d)", rc);
+		return rc;
+	}
+
+	gpio_init_callback(&data->int_cb, max30101_int_handler,
+			   BIT(config->int_gpio.pin));
+
+	rc = gpio_add_callback(config->int_gpio.port, &data->int_cb);
+	if (rc < 0) {
+		LOG_ERR("Could not add INT callback (%d)", rc);
+		return rc;
+	}
+
+	return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_DRIVERS_MAX30101_EMUL_H_
+#define APP_DRIVERS_MAX30101_EMUL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/drivers/emul.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup max30101_emul MAX30101 emulator
+ * @{
+ *
+ * @brief Register level I2C emulator for the MAX30101
+ *
+ * Models the register map, the 32 record FIFO with its pointers and
+ * overflow counter, sampling at the configured rate and the INT line. The
+ * FIFO records come from a waveform that is played back one entry per
+ * record, either the one set with max30101_emul_set_waveform(), the CSV
+ * recording selected by CONFIG_MAX30101_EMUL_WAVEFORM or a built-in
+ * synthetic pulse.
+ */
+
+/**
+ * @brief Play back a waveform
+ *
+ * Entry n holds the red, IR and green ADC counts of FIFO record n. They are
+ * reported as given at an LED pulse amplitude of
+ * CONFIG_MAX30101_EMUL_REFERENCE_PA and scale with it. Playback starts over
+ * at the first entry and wraps around.
+ *
+ * @param target Emulator instance
+ * @param samples Waveform, must stay valid while it is played, NULL restores
+ *        the default one
+ * @param count Number of entries in @p samples
+ */
+void max30101_emul_set_waveform(const struct emul *target,
+				const uint32_t (*samples)[3], size_t count);
+
+/**
+ * @brief Set the sensor oscillator error
+ *
+ * @param target Emulator instance
+ * @param ppm Positive values make the sensor sample slower than nominal
+ */
+void max30101_emul_set_clock_ppm(const struct emul *target, int32_t ppm);
+
+/**
+ * @brief Set the die temperature the next conversion reports
+ *
+ * @param target Emulator instance
+ * @param sixteenths Temperature in 1/16 degree C
+ */
+void max30101_emul_set_temperature(const struct emul *target,
+				   int16_t sixteenths);
+
+/**
+ * @brief Get the number of records the sensor has sampled and lost
+ *
+ * @param target Emulator instance
+ * @param written Records sampled since the last reset
+ * @param lost Of those, records lost to a full FIFO
+ */
+void max30101_emul_get_counts(const struct emul *target, uint32_t *written,
+			      uint32_t *lost);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APP_DRIVERS_MAX30101_EMUL_H_ */
@@ -0,0 +1,64 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_DRIVERS_MAX30101_INT_H_
+#define APP_DRIVERS_MAX30101_INT_H_
+
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/sys/util.h>
+
+/**
+ * @defgroup max30101_int MAX30101 INT line
+ * @{
+ *
+ * @brief INT line of a maxim,max30101 node
+ *
+ * The upstream maxim,max30101 binding has no INT pin, so the lines are
+ * listed in zephyr,user: ppg-int-gpios, and in ppg-int-sensors the sensor
+ * each one belongs to, entry for entry:
+ *
+ * @code{.dts}
+ * / {
+ *	zephyr,user {
+ *		ppg-int-gpios = <&gpio0 2 (GPIO_PULL_UP | GPIO_ACTIVE_LOW)>;
+ *		ppg-int-sensors = <&ppg0>;
+ *	};
+ * };
+ * @endcode
+ *
+ * A sensor not listed has no INT line.
+ */
+
+/** @cond INTERNAL_HIDDEN */
+
+#define Z_MAX30101_INT_USER DT_PATH(zephyr_user)
+
+/* "(spec)," for the entry of node_id, nothing for the others */
+#define Z_MAX30101_INT_MATCH(user, prop, idx, node_id)                         \
+	COND_CODE_1(DT_SAME_NODE(DT_PHANDLE_BY_IDX(user, prop, idx), node_id), \
+		    ((GPIO_DT_SPEC_GET_BY_IDX(user, ppg_int_gpios, idx)),), ())
+
+#define Z_MAX30101_INT_DEBRACKET(spec) __DEBRACKET spec
+#define Z_MAX30101_INT_FIRST(...)                                              \
+	Z_MAX30101_INT_DEBRACKET(GET_ARG_N(1, __VA_ARGS__))
+
+/** @endcond */
+
+/**
+ * @brief INT line of a sensor, as a gpio_dt_spec initializer
+ *
+ * @param node_id maxim,max30101 node
+ * @param default_value Initializer for a sensor without an INT line
+ */
+#define MAX30101_INT_GPIO_DT_SPEC_GET_OR(node_id, default_value)               \
+	COND_CODE_1(DT_NODE_HAS_PROP(Z_MAX30101_INT_USER, ppg_int_sensors),    \
+		    (Z_MAX30101_INT_FIRST(DT_FOREACH_PROP_ELEM_VARGS(          \
+			    Z_MAX30101_INT_USER, ppg_int_sensors,              \
+			    Z_MAX30101_INT_MATCH, node_id)(default_value))),   \
+		    (default_value))
+
+/** @} */
+
+#endif /* APP_DRIVERS_MAX30101_INT_H_ */
@@ -0,0 +1,113 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Synthetic PPG shared by the PPG tests
+ *
+ * Each beat is a systolic pulse 0.15 beats in with a dicrotic wave at 0.45
+ * beats, 0.4 of its height. Every channel is the same pulse, of its own
+ * height, dipping its own DC level, with breathing wander and uniform noise
+ * on top. The noise comes from test_rand(), so every run of a test sees the
+ * same signal.
+ *
+ * ppg_sim_run() feeds the samples one at a time to the code under test, the
+ * way the process thread does, through a sink function of the test's.
+ */
+
+#ifndef PPG_SIM_H_
+#define PPG_SIM_H_
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "test_rand.h"
+
+#define PPG_SIM_PI 3.14159265358979
+#define PPG_SIM_CHANNELS 3
+
+/* Breathing rate of the wander, Hz */
+#define PPG_SIM_BREATHING_HZ 0.25
+
+struct ppg_sim {
+	double fs;
+	double bpm;
+	double dc[PPG_SIM_CHANNELS]; /* Level of each channel, ADC counts */
+	double ac[PPG_SIM_CHANNELS]; /* Pulse height of each channel */
+	double wander;               /* Breathing, peak, ADC counts */
+	double noise;                /* Uniform noise, peak, ADC counts */
+	double offset;               /* Added to every channel, for transients */
+	double phase;                /* Beats since the start */
+	uint32_t n;                  /* Samples since the start */
+	uint32_t x; /* Noise generator state, seed with any non-zero value */
+};
+
+/*
+ * Takes sample x[] of every channel, and may change it. Returns whether the
+ * code under test had an output for it.
+ */
+typedef bool (*ppg_sim_sink)(void *ctx, float x[PPG_SIM_CHANNELS]);
+
+/* Uniform noise in [-1, 1) */
+static inline double ppg_sim_noise(struct ppg_sim *s)
+{
+	return (double)(test_rand(&s->x) % 2000) / 1000.0 - 1.0;
+}
+
+static inline double ppg_sim_bump(double p, double centre, double width)
+{
+	double d = (p - centre) / width;
+
+	return exp(-d * d);
+}
+
+/*
+ * Pulse of the current sample, 0 between beats and about 1 at the peak, and
+ * on to the next beat phase
+ */
+static inline double ppg_sim_pulse(struct ppg_sim *s)
+{
+	double p = s->phase - floor(s->phase);
+	double pulse = ppg_sim_bump(p, 0.15, 0.08) + 0.4 * ppg_sim_bump(p, 0.45, 0.08);
+
+	s->phase += s->bpm / 60.0 / s->fs;
+
+	return pulse;
+}
+
+/* Next sample of every channel, ADC counts */
+static inline void ppg_sim_sample(struct ppg_sim *s, float x[PPG_SIM_CHANNELS])
+{
+	double t = s->n / s->fs;
+	double pulse = ppg_sim_pulse(s);
+	double wander = s->wander * sin(2 * PPG_SIM_PI * PPG_SIM_BREATHING_HZ * t);
+
+	for (int c = 0; c < PPG_SIM_CHANNELS; c++) {
+		double noise = s->noise != 0 ? s->noise * ppg_sim_noise(s) : 0;
+
+		x[c] = (float)(s->dc[c] + s->offset - s->ac[c] * pulse - wander + noise);
+	}
+	s->n++;
+}
+
+/* Feed 'seconds' of the simulation to 'sink'. Returns the number of outputs. */
+static inline uint32_t ppg_sim_run(struct ppg_sim *s, double seconds, ppg_sim_sink sink,
+				   void *ctx)
+{
+	uint32_t count = (uint32_t)(seconds * s->fs);
+	uint32_t outputs = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		float x[PPG_SIM_CHANNELS];
+
+		ppg_sim_sample(s, x);
+		if (sink(ctx, x)) {
+			outputs++;
+		}
+	}
+
+	return outputs;
+}
+
+#endif /* PPG_SIM_H_ */
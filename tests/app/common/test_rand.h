@@ -0,0 +1,26 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Reproducible pseudo random numbers for the tests
+ *
+ * A xorshift generator: every run of a test sees the same sequence for the
+ * same seed, and the state is the caller's, so tests don't share it.
+ */
+
+#ifndef TEST_RAND_H_
+#define TEST_RAND_H_
+
+#include <stdint.h>
+
+/* Next value of the generator, seed *x with any non-zero value */
+static inline uint32_t test_rand(uint32_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 17;
+	*x ^= *x << 5;
+	return *x;
+}
+
+#endif /* TEST_RAND_H_ */
@@ -0,0 +1,323 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test MAX30101 driver against the register level emulator
+ *
+ * Runs the application's MAX30101 class on native_sim, with the sensor
+ * emulated on i2c0 and its INT line on gpio0. Covers sample timing, FIFO
+ * overflow accounting, the almost full interrupt and its acknowledge, live
+ * reconfiguration, the die temperature and the compile-time slot layout
+ * storage, and reports the bus cost of streaming at the highest output rate.
+ */
+
+#include <zephyr/ztest.h>
+#include <zephyr/drivers/emul.h>
+
+#include <app/drivers/max30101_emul.h>
+#include <app/drivers/max30101_int.h>
+
+#include "MAX30101.hpp"
+#include "MAX30101Storage.hpp"
+
+#define PPG_NODE DT_NODELABEL(ppg)
+
+static const struct i2c_dt_spec ppg_i2c = I2C_DT_SPEC_GET(PPG_NODE);
+static const struct gpio_dt_spec ppg_int =
+	MAX30101_INT_GPIO_DT_SPEC_GET_OR(PPG_NODE, {0});
+static const struct emul *ppg_emul = EMUL_DT_GET(PPG_NODE);
+
+static MAX30101 ppg;
+
+/* Red, IR and green step by one per record */
+static uint32_t ramp[256][3];
+
+/* All three LEDs at the emulator's reference amplitude, full resolution */
+static void setup_ppg(uint8_t sampleAverage, int sampleRate)
+{
+	ppg.setup(CONFIG_MAX30101_EMUL_REFERENCE_PA,
+		  CONFIG_MAX30101_EMUL_REFERENCE_PA,
+		  CONFIG_MAX30101_EMUL_REFERENCE_PA, sampleAverage, 3, sampleRate,
+		  411, 16384);
+}
+
+/* Consume everything in the sample ring */
+static void drain(void)
+{
+	ppg.consumeSamples(ppg.available());
+}
+
+/*
+ * Copy the unread red and IR samples out of the ring, which may hold them in
+ * two runs. Returns the count, *marker gets the reconfiguration marker.
+ */
+static uint16_t collect(uint32_t *red, uint32_t *ir, int *marker)
+{
+	struct max30101_samples runs[2];
+	uint8_t runCount = ppg.getSamples(runs);
+	uint16_t count = 0;
+
+	*marker = -1;
+	for (uint8_t r = 0; r < runCount; r++) {
+		if (runs[r].configStart >= 0) {
+			*marker = count + runs[r].configStart;
+		}
+		for (uint16_t i = 0; i < runs[r].count; i++, count++) {
+			red[count] = runs[r].red[i];
+			ir[count] = runs[r].ir[i];
+		}
+	}
+
+	return count;
+}
+
+static void *max30101_emul_setup(void)
+{
+	for (uint32_t i = 0; i < ARRAY_SIZE(ramp); i++) {
+		ramp[i][0] = 100000 + i;
+		ramp[i][1] = 110000 + i;
+		ramp[i][2] = 120000 + i;
+	}
+
+	return NULL;
+}
+
+static void max30101_emul_before(void *fixture)
+{
+	max30101_emul_set_waveform(ppg_emul, NULL, 0);
+	max30101_emul_set_clock_ppm(ppg_emul, 0);
+
+	zassert_true(ppg.begin(&ppg_i2c), "MAX30101 not found");
+	drain();
+}
+
+ZTEST(max30101_emul, test_part_id)
+{
+	zassert_equal(ppg.readPartID(), 0x15, "wrong part ID");
+}
+
+ZTEST(max30101_emul, test_sample_rate)
+{
+	max30101_emul_set_waveform(ppg_emul, ramp, ARRAY_SIZE(ramp));
+	setup_ppg(1, 400);
+
+	k_msleep(50);
+
+	/* 20 records at 400 Hz, give or take the one in conversion */
+	uint16_t count = ppg.check();
+	int marker;
+
+	zassert_within(count, 20, 1, "%u samples in 50 ms", count);
+
+	/* Consecutive records are consecutive waveform entries */
+	uint32_t red[32], ir[32];
+
+	zassert_equal(collect(red, ir, &marker), count);
+	for (uint16_t i = 1; i < count; i++) {
+		zassert_equal(red[i], red[i - 1] + 1);
+		zassert_equal(ir[i], red[i] + 10000);
+	}
+	drain();
+
+	/* A poll faster than the FIFO fills keeps up exactly */
+	for (int i = 0; i < 10; i++) {
+		k_msleep(20);
+		count = ppg.check();
+		zassert_within(count, 8, 1, "%u samples in 20 ms", count);
+		drain();
+	}
+}
+
+ZTEST(max30101_emul, test_overflow)
+{
+	struct max30101_loss_stats stats;
+	uint32_t written, lost;
+
+	setup_ppg(1, 400);
+
+	/* 40 records into a 32 record FIFO */
+	k_msleep(100);
+	zassert_equal(ppg.check(), 32);
+
+	ppg.getLossStats(&stats);
+	max30101_emul_get_counts(ppg_emul, &written, &lost);
+
+	zassert_true(lost > 0, "FIFO did not overflow");
+	zassert_equal(stats.fifoLost, lost, "driver saw %u of %u lost",
+		      stats.fifoLost, lost);
+	zassert_equal(stats.overflowBatches, 1);
+	drain();
+}
+
+ZTEST(max30101_emul, test_interrupt)
+{
+	setup_ppg(1, 400);
+	ppg.getINT1(); /* PWR_RDY holds INT low since power on */
+
+	zassert_true(ppg.beginInterrupt(&ppg_int));
+	ppg.enableFIFOInterrupt(24);
+
+	int64_t start = k_uptime_get();
+
+	zassert_true(ppg.waitForFIFO(K_MSEC(500)), "no A_FULL interrupt");
+
+	/* 24 records at 400 Hz */
+	int64_t elapsed = k_uptime_get() - start;
+
+	zassert_within(elapsed, 60, 5, "INT after %lld ms", elapsed);
+	zassert_true(ppg.check() >= 24);
+	drain();
+
+	/* Emptying the FIFO doesn't clear A_FULL, only INTSTAT1 does */
+	k_msleep(70);
+	zassert_true(ppg.check() >= 24);
+	drain();
+	zassert_equal(gpio_pin_get_dt(&ppg_int), 1, "A_FULL cleared by FIFO read");
+	zassert_true(ppg.waitForFIFO(K_NO_WAIT));
+	zassert_equal(gpio_pin_get_dt(&ppg_int), 0, "A_FULL not acknowledged");
+
+	/* Once acknowledged, the next 24 records raise it again */
+	start = k_uptime_get();
+	zassert_true(ppg.waitForFIFO(K_MSEC(500)), "no second A_FULL interrupt");
+
+	elapsed = k_uptime_get() - start;
+	zassert_within(elapsed, 60, 5, "second INT after %lld ms", elapsed);
+	zassert_true(ppg.check() >= 24);
+	drain();
+}
+
+ZTEST(max30101_emul, test_reconfigure)
+{
+	const uint32_t level[1][3] = {{100000, 100000, 100000}};
+
+	max30101_emul_set_waveform(ppg_emul, level, 1);
+	setup_ppg(1, 400);
+
+	k_msleep(20);
+	ppg.check();
+	drain();
+	k_msleep(20);
+
+	/* Nothing staged */
+	zassert_equal(ppg.reconfigure(), -EINVAL);
+
+	/* Half the red current, nothing else changes */
+	ppg.beginConfig();
+	ppg.setPulseAmplitudeRed(CONFIG_MAX30101_EMUL_REFERENCE_PA / 2);
+	zassert_ok(ppg.reconfigure());
+
+	k_msleep(20);
+	ppg.check();
+
+	uint32_t red[32], ir[32];
+	int marker;
+	uint16_t count = collect(red, ir, &marker);
+	uint32_t dimmed = 100000 * (CONFIG_MAX30101_EMUL_REFERENCE_PA / 2) /
+			  CONFIG_MAX30101_EMUL_REFERENCE_PA;
+
+	/* Samples taken before the change lead, the marker is past them */
+	zassert_true(marker > 0, "no reconfiguration marker");
+	zassert_equal(red[0], 100000);
+	for (int i = marker; i < count; i++) {
+		zassert_equal(red[i], dimmed, "sample %d", i);
+		zassert_equal(ir[i], 100000, "sample %d", i);
+	}
+	drain();
+}
+
+/* IR sampled before red, the storage has to follow the layout */
+using IRRed = MAX30101Storage<MAX3010x_SLOT_IR_LED2_PA, MAX3010x_SLOT_RED_LED1_PA>;
+
+ZTEST(max30101_emul, test_storage)
+{
+	static IRRed samples;
+	static MAX30101Storage<MAX3010x_SLOT_RED_LED1_PA> redOnly;
+
+	max30101_emul_set_waveform(ppg_emul, ramp, ARRAY_SIZE(ramp));
+	setup_ppg(1, 400);
+	ppg.setupSlots<IRRed>();
+	ppg.clearFIFO();
+
+	k_msleep(50);
+
+	/* 20 records at 400 Hz, give or take the one in conversion */
+	uint16_t count = ppg.check(samples);
+
+	zassert_within(count, 20, 1, "%u samples in 50 ms", count);
+	zassert_equal(samples.available(), count);
+
+	uint32_t red = samples.get<MAX3010x_SLOT_RED_LED1_PA>();
+
+	for (uint16_t i = 0; i < count; i++, samples.nextSample()) {
+		zassert_equal(samples.get<MAX3010x_SLOT_RED_LED1_PA>(), red + i,
+			      "sample %u", i);
+		zassert_equal(samples.get<MAX3010x_SLOT_IR_LED2_PA>(), red + i + 10000,
+			      "sample %u", i);
+	}
+	zassert_equal(samples.available(), 0);
+
+	/* A layout the sensor isn't set up for gets nothing */
+	k_msleep(10);
+	zassert_equal(ppg.check(redOnly), 0);
+	zassert_equal(redOnly.available(), 0);
+}
+
+ZTEST(max30101_emul, test_temperature)
+{
+	float celsius;
+
+	setup_ppg(1, 400);
+
+	max30101_emul_set_temperature(ppg_emul, 25 * 16 + 8);
+	zassert_within(ppg.readTemperature(), 25.5f, 0.001f);
+
+	/* The conversion runs while the FIFO is read */
+	max30101_emul_set_temperature(ppg_emul, -3 * 16 + 4);
+	zassert_true(ppg.startTemperature());
+	zassert_false(ppg.pollTemperature(), "conversion can't be done yet");
+	k_msleep(30);
+	zassert_true(ppg.pollTemperature());
+	zassert_true(ppg.getTemperature(&celsius));
+	zassert_within(celsius, -2.75f, 0.001f);
+}
+
+/* Bus cost of streaming three LEDs at 3200 Hz, polled every 5 ms */
+ZTEST(max30101_emul, test_throughput)
+{
+	struct max30101_loss_stats stats;
+	struct max30101_i2c_stats bus;
+	uint32_t samples = 0;
+
+	setup_ppg(1, 3200);
+	ppg.resetI2CTransactionCount();
+	ppg.resetLossStats();
+
+	for (int i = 0; i < 200; i++) {
+		k_msleep(5);
+		samples += ppg.check();
+		drain();
+	}
+
+	ppg.getLossStats(&stats);
+	ppg.getI2CStats(&bus);
+
+	const struct max30101_i2c_op_stats &burst =
+		bus.op[MAX30101_I2C_BURST_READ];
+
+	TC_PRINT("%u samples, %u I2C transactions, %u lost\n", samples,
+		 ppg.getI2CTransactionCount(), stats.fifoLost);
+	TC_PRINT("%u burst reads, %u bytes, %u us on the bus\n",
+		 burst.transactions, burst.bytes, burst.busyUs);
+
+	zassert_within(samples, 3200, 32, "%u samples in 1 s", samples);
+	zassert_equal(stats.fifoLost, 0);
+	/* One state read and one data burst per poll */
+	zassert_true(ppg.getI2CTransactionCount() <= 2 * 200 + 2);
+	/* Every record read once, 9 bytes with three LEDs */
+	zassert_equal(burst.errors, 0);
+	zassert_true(burst.bytes >= samples * 9);
+}
+
+ZTEST_SUITE(max30101_emul, NULL, max30101_emul_setup, max30101_emul_before,
+	    NULL, NULL);
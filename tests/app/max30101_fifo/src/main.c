@@ -0,0 +1,163 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test max30101_fifo block decoder
+ *
+ * This suite checks that max30101_fifo_unpack() decodes FIFO bursts exactly
+ * like the byte-by-byte loop the driver used before, and benchmarks the two
+ * on the host for a full 32-deep FIFO.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include <zephyr/ztest.h>
+
+#include "max30101_fifo.h"
+
+#define FIFO_DEPTH 32
+#define MAX_CHANNELS 3
+#define BENCH_ROUNDS 200000
+
+static uint8_t fifo[FIFO_DEPTH * MAX_CHANNELS * 3];
+
+/* The previous MAX30101::check() inner loop, kept as the reference */
+struct reference_reader {
+	const uint8_t *buf;
+	uint16_t i;
+	uint16_t used;
+};
+
+static uint8_t reference_next(struct reference_reader *r)
+{
+	if (r->i < r->used) {
+		return r->buf[r->i++];
+	}
+	return 0;
+}
+
+static uint32_t reference_word(struct reference_reader *r)
+{
+	uint8_t temp[sizeof(uint32_t)];
+	uint32_t tempLong;
+
+	temp[3] = 0;
+	temp[2] = reference_next(r);
+	temp[1] = reference_next(r);
+	temp[0] = reference_next(r);
+
+	memcpy(&tempLong, temp, sizeof(tempLong));
+
+	return tempLong & 0x3FFFF;
+}
+
+static void reference_unpack(const uint8_t *buf, int samples, uint8_t activeLEDs,
+			     uint32_t *red, uint32_t *ir, uint32_t *green)
+{
+	struct reference_reader r = {
+		.buf = buf,
+		.i = 0,
+		.used = samples * activeLEDs * 3,
+	};
+	int toGet = r.used;
+	int n = 0;
+
+	while (toGet > 0) {
+		red[n] = reference_word(&r);
+		if (activeLEDs > 1) {
+			ir[n] = reference_word(&r);
+		}
+		if (activeLEDs > 2) {
+			green[n] = reference_word(&r);
+		}
+		n++;
+		toGet -= activeLEDs * 3;
+	}
+}
+
+static void fill_fifo(void)
+{
+	uint32_t x = 0x12345678;
+
+	for (size_t i = 0; i < sizeof(fifo); i++) {
+		/* xorshift, the top bits must be masked off by the decoder */
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		fifo[i] = (uint8_t)x;
+	}
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+ZTEST(max30101_fifo, test_unpack_matches_reference)
+{
+	fill_fifo();
+
+	for (uint8_t channels = 1; channels <= MAX_CHANNELS; channels++) {
+		uint32_t ref[MAX_CHANNELS][FIFO_DEPTH] = {0};
+		uint32_t out[MAX_CHANNELS][FIFO_DEPTH] = {0};
+		uint32_t *const dst[] = {out[0], out[1], out[2]};
+
+		reference_unpack(fifo, FIFO_DEPTH, channels, ref[0], ref[1], ref[2]);
+		size_t used = max30101_fifo_unpack(fifo, FIFO_DEPTH, channels, dst);
+
+		zassert_equal(used, FIFO_DEPTH * channels * 3,
+			      "wrong byte count for %d channels", channels);
+		zassert_mem_equal(out, ref, sizeof(out),
+				  "decode differs for %d channels", channels);
+	}
+}
+
+ZTEST(max30101_fifo, test_unpack_masks_to_18_bits)
+{
+	const uint8_t word[3] = {0xFF, 0xFF, 0xFF};
+
+	zassert_equal(max30101_fifo_word(word), 0x3FFFF, "top bits not masked");
+}
+
+ZTEST(max30101_fifo, test_benchmark)
+{
+	static uint32_t out[MAX_CHANNELS][FIFO_DEPTH];
+	uint32_t *const dst[] = {out[0], out[1], out[2]};
+	volatile uint32_t sink = 0;
+
+	fill_fifo();
+
+	for (uint8_t channels = 1; channels <= MAX_CHANNELS; channels++) {
+		uint64_t start = now_ns();
+
+		for (int i = 0; i < BENCH_ROUNDS; i++) {
+			reference_unpack(fifo, FIFO_DEPTH, channels, out[0], out[1], out[2]);
+			sink += out[0][i % FIFO_DEPTH];
+		}
+
+		uint64_t reference = now_ns() - start;
+
+		start = now_ns();
+
+		for (int i = 0; i < BENCH_ROUNDS; i++) {
+			max30101_fifo_unpack(fifo, FIFO_DEPTH, channels, dst);
+			sink += out[0][i % FIFO_DEPTH];
+		}
+
+		uint64_t block = now_ns() - start;
+		uint64_t samples = (uint64_t)BENCH_ROUNDS * FIFO_DEPTH;
+
+		TC_PRINT("%d channel(s): byte loop %u ps/sample, block %u ps/sample\n",
+			 channels, (unsigned int)(reference * 1000 / samples),
+			 (unsigned int)(block * 1000 / samples));
+	}
+
+	ARG_UNUSED(sink);
+}
+
+ZTEST_SUITE(max30101_fifo, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,100 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test max30101_timebase sample timestamp reconstruction
+ *
+ * A simulated sensor writes samples on a clock that is off by a known amount,
+ * and is read at a jittered batch interval the way the acquisition thread
+ * polls it. The loop must recover the sensor rate and keep the reconstructed
+ * sample times within a sample period of the truth.
+ */
+
+#include <math.h>
+
+#include <zephyr/ztest.h>
+
+#include "max30101_timebase.h"
+#include "test_rand.h"
+
+#define NOMINAL_US 10000.0f /* 100 Hz */
+#define BATCH_US 240000
+#define SIM_SECONDS 300
+
+/*
+ * A sensor whose clock is off by 'ppm' is read every BATCH_US, late by up to a
+ * sample period. The loop must find the drift, and over the second half keep
+ * the newest sample's time within a sample period of the truth.
+ */
+static void check_drift(double ppm, uint32_t seed)
+{
+	struct max30101_timebase tb;
+	double period_us = NOMINAL_US * (1 + ppm * 1e-6);
+	double next_us = 0; /* True time the next sample is written */
+	double newest = 0;
+	double max_error = 0;
+
+	max30101_timebase_reset(&tb, NOMINAL_US);
+
+	for (int64_t t = BATCH_US; t < (int64_t)SIM_SECONDS * 1000000; t += BATCH_US) {
+		int64_t now = t + test_rand(&seed) % (int64_t)NOMINAL_US;
+		uint32_t written = 0;
+
+		while (next_us <= now) {
+			newest = next_us;
+			next_us += period_us;
+			written++;
+		}
+		max30101_timebase_update(&tb, now, written);
+
+		if (t > (int64_t)(SIM_SECONDS / 2) * 1000000) {
+			max_error = MAX(max_error, fabs((double)max30101_timebase_at(&tb, 0) - newest));
+		}
+	}
+
+	float drift = max30101_timebase_drift_ppm(&tb);
+
+	TC_PRINT("%+.0f ppm: drift %.1f ppm, worst newest sample error %.0f us\n", ppm,
+		 (double)drift, max_error);
+	zassert_within(drift, ppm, 30, "drift %d ppm", (int)drift);
+	zassert_true(max_error < NOMINAL_US, "timestamps off by %d us", (int)max_error);
+}
+
+ZTEST(max30101_timebase, test_tracks_slow_sensor)
+{
+	check_drift(300, 1);
+}
+
+ZTEST(max30101_timebase, test_tracks_fast_sensor)
+{
+	check_drift(-2000, 7);
+}
+
+ZTEST(max30101_timebase, test_sample_ages)
+{
+	struct max30101_timebase tb;
+
+	max30101_timebase_reset(&tb, NOMINAL_US);
+	max30101_timebase_update(&tb, 1000000, 24);
+
+	zassert_equal(max30101_timebase_at(&tb, 0), 1000000, "newest");
+	zassert_equal(max30101_timebase_at(&tb, 23), 1000000 - 23 * 10000, "oldest");
+}
+
+ZTEST(max30101_timebase, test_resync_after_stall)
+{
+	struct max30101_timebase tb;
+
+	max30101_timebase_reset(&tb, NOMINAL_US);
+	max30101_timebase_update(&tb, 1000000, 24);
+	max30101_timebase_update(&tb, 1240000, 24);
+
+	/* Samples went missing without being accounted for */
+	max30101_timebase_update(&tb, 5000000, 24);
+
+	zassert_equal(max30101_timebase_at(&tb, 0), 5000000, "not re-anchored");
+	zassert_within(max30101_timebase_drift_ppm(&tb), 0, 1, "period disturbed");
+}
+
+ZTEST_SUITE(max30101_timebase, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,407 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test PPG batch filtering
+ *
+ * This suite checks that ppg_filter_block() and the lockstep filter bank,
+ * over batches of any size, give the same output as the one sample per call
+ * loop the process thread used before, with the filter state carried from
+ * one batch to the next, and that the Q31 and Q15 pipelines follow it to
+ * within their resolution without overflowing at full scale. It benchmarks
+ * them all in cycles per sample for the channels of one sensor, and the
+ * float ones for two sensors filtered as one bank. It also checks that the
+ * generated coefficient tables are picked by rate and all pass DC at unity
+ * gain.
+ */
+
+#include <float.h>
+#include <math.h>
+
+#include <zephyr/ztest.h>
+#include <zephyr/timing/timing.h>
+
+#include "ppg_filter.h"
+
+#define SIGNAL_LENGTH 320
+/* Two sensors of three channels, the first three are one sensor's */
+#define CHANNELS 6
+#define SENSOR_CHANNELS 3
+#define BENCH_ROUNDS 30
+/*
+ * Float error allowed against the reference, relative: the kernels may
+ * round in another order, a few ulp of whatever level the signal is at
+ */
+#define FLOAT_TOLERANCE (4 * FLT_EPSILON)
+
+static uint32_t raw[CHANNELS][SIGNAL_LENGTH];
+static float32_t ref[CHANNELS][SIGNAL_LENGTH];
+static float32_t out[CHANNELS][SIGNAL_LENGTH];
+static float32_t bank_out[CHANNELS][SIGNAL_LENGTH];
+static q31_t out_q31[SENSOR_CHANNELS][SIGNAL_LENGTH];
+static q15_t out_q15[SENSOR_CHANNELS][SIGNAL_LENGTH];
+
+/* Coefficient table under test, see ppg_filter_setup() */
+static uint8_t table;
+
+/* A pulse on a large DC level, with some 50 Hz, like the ADC counts */
+static void fill_signal(void)
+{
+	for (int i = 0; i < SIGNAL_LENGTH; i++) {
+		float t = i / 100.0f;
+
+		for (int ch = 0; ch < CHANNELS; ch++) {
+			raw[ch][i] = 100000 + 10000 * ch +
+				     (uint32_t)(2000.0f + 1500.0f * sinf(2 * PI * 1.2f * t) +
+						300.0f * sinf(2 * PI * 50.0f * t));
+		}
+	}
+}
+
+/* The previous ppg_process_entry_point() loop, kept as the reference */
+static void reference_filter(arm_biquad_cascade_df2T_instance_f32 *iir, int channels,
+			     uint32_t count, uint32_t first,
+			     float32_t y[CHANNELS][SIGNAL_LENGTH])
+{
+	for (uint32_t i = first; i < first + count; i++) {
+		for (int ch = 0; ch < channels; ch++) {
+			float32_t in = (float32_t)raw[ch][i];
+
+			arm_biquad_cascade_df2T_f32(&iir[ch], &in, &y[ch][i], 1);
+		}
+	}
+}
+
+static void block_filter(arm_biquad_cascade_df2T_instance_f32 *iir, int channels,
+			 uint32_t count, uint32_t first, float32_t y[CHANNELS][SIGNAL_LENGTH])
+{
+	for (int ch = 0; ch < channels; ch++) {
+		ppg_filter_block(&iir[ch], &raw[ch][first], &y[ch][first], count);
+	}
+}
+
+static void bank_filter(struct ppg_filter_bank *bank, uint32_t count, uint32_t first,
+			float32_t y[CHANNELS][SIGNAL_LENGTH])
+{
+	const uint32_t *in[CHANNELS];
+	float32_t *dst[CHANNELS];
+
+	for (int ch = 0; ch < bank->channels; ch++) {
+		in[ch] = &raw[ch][first];
+		dst[ch] = &y[ch][first];
+	}
+
+	ppg_filter_bank_run(bank, in, dst, count);
+}
+
+static void q31_filter(arm_biquad_casd_df1_inst_q31 *iir, uint32_t count, uint32_t first)
+{
+	for (int ch = 0; ch < SENSOR_CHANNELS; ch++) {
+		ppg_filter_block_q31(&iir[ch], &raw[ch][first], &out_q31[ch][first], count);
+	}
+}
+
+static void q15_filter(arm_biquad_casd_df1_inst_q15 *iir, uint32_t count, uint32_t first)
+{
+	for (int ch = 0; ch < SENSOR_CHANNELS; ch++) {
+		ppg_filter_block_q15(&iir[ch], &raw[ch][first], &out_q15[ch][first], count);
+	}
+}
+
+static void init_filters(arm_biquad_cascade_df2T_instance_f32 *iir,
+			 float32_t state[CHANNELS][2 * PPG_IIR_NUMSTAGES])
+{
+	for (int ch = 0; ch < CHANNELS; ch++) {
+		ppg_filter_init(&iir[ch], state[ch], table);
+	}
+}
+
+ZTEST(ppg_filter, test_block_matches_per_sample)
+{
+	/* FIFO batches of all sizes, odd ones leave the unrolled loop a tail */
+	static const uint16_t batches[] = {1, 7, 24, 32, 3, 128, 5, 31, 64};
+	arm_biquad_cascade_df2T_instance_f32 ref_iir[CHANNELS], iir[CHANNELS];
+	float32_t ref_state[CHANNELS][2 * PPG_IIR_NUMSTAGES];
+	float32_t state[CHANNELS][2 * PPG_IIR_NUMSTAGES];
+	float32_t bank_state[PPG_FILTER_BANK_SIZE(CHANNELS)];
+	struct ppg_filter_bank bank;
+	uint32_t first = 0;
+
+	fill_signal();
+	init_filters(ref_iir, ref_state);
+	init_filters(iir, state);
+	ppg_filter_bank_init(&bank, CHANNELS, bank_state, table);
+
+	for (size_t b = 0; b < ARRAY_SIZE(batches); b++) {
+		reference_filter(ref_iir, CHANNELS, batches[b], first, ref);
+		block_filter(iir, CHANNELS, batches[b], first, out);
+		bank_filter(&bank, batches[b], first, bank_out);
+		first += batches[b];
+	}
+
+	for (int ch = 0; ch < CHANNELS; ch++) {
+		for (uint32_t i = 0; i < first; i++) {
+			float32_t tolerance = FLOAT_TOLERANCE * fabsf(ref[ch][i]);
+
+			zassert_within(out[ch][i], ref[ch][i], tolerance,
+				       "channel %d sample %u: %f, expected %f", ch, i,
+				       (double)out[ch][i], (double)ref[ch][i]);
+			zassert_within(bank_out[ch][i], ref[ch][i], tolerance,
+				       "bank channel %d sample %u: %f, expected %f", ch, i,
+				       (double)bank_out[ch][i], (double)ref[ch][i]);
+		}
+	}
+}
+
+ZTEST(ppg_filter, test_bank_reset)
+{
+	float32_t state[PPG_FILTER_BANK_SIZE(SENSOR_CHANNELS)];
+	struct ppg_filter_bank bank;
+
+	fill_signal();
+	ppg_filter_bank_init(&bank, SENSOR_CHANNELS, state, table);
+
+	/* After a reset the output no longer depends on earlier samples */
+	bank_filter(&bank, 40, 0, out);
+	ppg_filter_bank_reset(&bank);
+	bank_filter(&bank, 40, 0, out);
+	ppg_filter_bank_init(&bank, SENSOR_CHANNELS, state, table);
+	bank_filter(&bank, 40, 0, bank_out);
+
+	zassert_mem_equal(out, bank_out, sizeof(out));
+}
+
+ZTEST(ppg_filter, test_fixed_point_matches_float)
+{
+	static const uint16_t batches[] = {1, 7, 24, 32, 3, 128, 5, 31, 64};
+	arm_biquad_cascade_df2T_instance_f32 iir[CHANNELS];
+	arm_biquad_casd_df1_inst_q31 iir_q31[SENSOR_CHANNELS];
+	arm_biquad_casd_df1_inst_q15 iir_q15[SENSOR_CHANNELS];
+	float32_t state[CHANNELS][2 * PPG_IIR_NUMSTAGES];
+	q31_t state_q31[SENSOR_CHANNELS][4 * PPG_IIR_NUMSTAGES];
+	q15_t state_q15[SENSOR_CHANNELS][4 * PPG_IIR_NUMSTAGES];
+	uint32_t first = 0;
+
+	fill_signal();
+	init_filters(iir, state);
+	for (int ch = 0; ch < SENSOR_CHANNELS; ch++) {
+		ppg_filter_init_q31(&iir_q31[ch], state_q31[ch], table);
+		ppg_filter_init_q15(&iir_q15[ch], state_q15[ch], table);
+	}
+
+	for (size_t b = 0; b < ARRAY_SIZE(batches); b++) {
+		reference_filter(iir, SENSOR_CHANNELS, batches[b], first, ref);
+		q31_filter(iir_q31, batches[b], first);
+		q15_filter(iir_q15, batches[b], first);
+		first += batches[b];
+	}
+
+	for (int ch = 0; ch < SENSOR_CHANNELS; ch++) {
+		for (uint32_t i = 0; i < first; i++) {
+			int32_t q31 = ppg_filter_counts_q31(out_q31[ch][i]);
+			int32_t q15 = ppg_filter_counts_q15(out_q15[ch][i]);
+
+			/* Rounding to whole counts */
+			zassert_within(q31, ref[ch][i], 1.0f, "Q31 channel %d sample %u: %d, expected %f",
+				       ch, i, q31, (double)ref[ch][i]);
+			/* Dropped low bits, a few steps of 16 counts */
+			zassert_within(q15, ref[ch][i], 64.0f, "Q15 channel %d sample %u: %d, expected %f",
+				       ch, i, q15, (double)ref[ch][i]);
+		}
+	}
+}
+
+ZTEST(ppg_filter, test_fixed_point_full_scale)
+{
+	arm_biquad_casd_df1_inst_q31 iir_q31;
+	arm_biquad_casd_df1_inst_q15 iir_q15;
+	q31_t state_q31[4 * PPG_IIR_NUMSTAGES];
+	q15_t state_q15[4 * PPG_IIR_NUMSTAGES];
+	int32_t q31_peak = 0, q15_peak = 0;
+
+	/* Full scale steps in and out, the worst case for overshoot */
+	for (int i = 0; i < SIGNAL_LENGTH; i++) {
+		raw[0][i] = (i / 8) % 2 ? 0 : 0x3FFFF;
+	}
+
+	ppg_filter_init_q31(&iir_q31, state_q31, table);
+	ppg_filter_init_q15(&iir_q15, state_q15, table);
+	ppg_filter_block_q31(&iir_q31, raw[0], out_q31[0], SIGNAL_LENGTH);
+	ppg_filter_block_q15(&iir_q15, raw[0], out_q15[0], SIGNAL_LENGTH);
+
+	for (int i = 0; i < SIGNAL_LENGTH; i++) {
+		int32_t q31 = ppg_filter_counts_q31(out_q31[0][i]);
+		int32_t q15 = ppg_filter_counts_q15(out_q15[0][i]);
+
+		/* A wrapped accumulator would show as a large negative value */
+		zassert_true(q31 > -0x3FFFF / 2, "Q31 sample %d wrapped: %d", i, q31);
+		zassert_true(q15 > -0x3FFFF / 2, "Q15 sample %d wrapped: %d", i, q15);
+		q31_peak = MAX(q31_peak, q31);
+		q15_peak = MAX(q15_peak, q15);
+	}
+
+	/* The steps settle, the level comes through with unity gain */
+	zassert_true(q31_peak >= 0x3FFFF - 1, "Q31 peak %d", q31_peak);
+	zassert_true(q15_peak >= 0x3FFFF - 64, "Q15 peak %d", q15_peak);
+}
+
+ZTEST(ppg_filter, test_select)
+{
+	/* Exact rates, including the fractional one */
+	for (uint8_t t = 0; t < PPG_IIR_TABLES; t++) {
+		zassert_equal(ppg_filter_select(ppg_iir_rates[t]), t, "%f Hz",
+			      (double)ppg_iir_rates[t]);
+	}
+
+	/* Anything in between gets the nearest one by ratio */
+	zassert_equal(ppg_iir_rates[ppg_filter_select(51.0f)], 50.0f);
+	zassert_equal(ppg_iir_rates[ppg_filter_select(60.0f)], 62.5f);
+
+	/* Past the ends there is none */
+	zassert_equal(ppg_filter_select(0.0f), -1);
+	zassert_equal(ppg_filter_select(ppg_iir_rates[0] * 0.99f), -1);
+	zassert_equal(ppg_filter_select(25.0f), -1);
+	zassert_equal(ppg_filter_select(ppg_iir_rates[PPG_IIR_TABLES - 1] * 1.01f), -1);
+	zassert_equal(ppg_filter_select(1e5f), -1);
+}
+
+ZTEST(ppg_filter, test_tables)
+{
+	arm_biquad_cascade_df2T_instance_f32 iir;
+	arm_biquad_casd_df1_inst_q31 iir_q31;
+	float32_t state[2 * PPG_IIR_NUMSTAGES];
+	q31_t state_q31[4 * PPG_IIR_NUMSTAGES];
+
+	/* A full scale DC level */
+	for (int i = 0; i < SIGNAL_LENGTH; i++) {
+		raw[0][i] = 0x3FFFF;
+	}
+
+	for (uint8_t t = 0; t < PPG_IIR_TABLES; t++) {
+		ppg_filter_init(&iir, state, t);
+		ppg_filter_init_q31(&iir_q31, state_q31, t);
+
+		/* A second of it, so the step response settles at every rate */
+		for (float32_t s = 0; s < ppg_iir_rates[t]; s += SIGNAL_LENGTH) {
+			ppg_filter_block(&iir, raw[0], out[0], SIGNAL_LENGTH);
+			ppg_filter_block_q31(&iir_q31, raw[0], out_q31[0], SIGNAL_LENGTH);
+		}
+
+		int32_t q31 = ppg_filter_counts_q31(out_q31[0][SIGNAL_LENGTH - 1]);
+
+		/* Rounding the float coefficients moves the poles near z = 1 */
+		zassert_within(out[0][SIGNAL_LENGTH - 1], 0x3FFFF, 0x3FFFF * 1e-4f, "%f Hz: %f",
+			       (double)ppg_iir_rates[t], (double)out[0][SIGNAL_LENGTH - 1]);
+		zassert_within(q31, 0x3FFFF, 1, "%f Hz Q31: %d", (double)ppg_iir_rates[t], q31);
+	}
+}
+
+ZTEST(ppg_filter, test_benchmark)
+{
+	/* One sample, a typical A_FULL batch, a full FIFO and a backlog */
+	static const uint16_t batches[] = {1, 24, 32, 128};
+	static const int channel_counts[] = {SENSOR_CHANNELS, CHANNELS};
+	arm_biquad_cascade_df2T_instance_f32 iir[CHANNELS];
+	float32_t state[CHANNELS][2 * PPG_IIR_NUMSTAGES];
+	float32_t bank_state[PPG_FILTER_BANK_SIZE(CHANNELS)];
+	struct ppg_filter_bank bank;
+	timing_t start, end;
+
+	fill_signal();
+	init_filters(iir, state);
+	timing_init();
+	timing_start();
+
+	for (size_t c = 0; c < ARRAY_SIZE(channel_counts); c++) {
+		int channels = channel_counts[c];
+
+		ppg_filter_bank_init(&bank, channels, bank_state, table);
+
+		for (size_t b = 0; b < ARRAY_SIZE(batches); b++) {
+			uint32_t batch = batches[b];
+			uint32_t slices = SIGNAL_LENGTH / batch;
+			uint32_t rounds = BENCH_ROUNDS * slices;
+			uint64_t samples = (uint64_t)rounds * batch;
+
+			start = timing_counter_get();
+			for (uint32_t i = 0; i < rounds; i++) {
+				reference_filter(iir, channels, batch, (i % slices) * batch, out);
+			}
+			end = timing_counter_get();
+
+			uint64_t reference = timing_cycles_get(&start, &end);
+
+			start = timing_counter_get();
+			for (uint32_t i = 0; i < rounds; i++) {
+				block_filter(iir, channels, batch, (i % slices) * batch, out);
+			}
+			end = timing_counter_get();
+
+			uint64_t block = timing_cycles_get(&start, &end);
+
+			start = timing_counter_get();
+			for (uint32_t i = 0; i < rounds; i++) {
+				bank_filter(&bank, batch, (i % slices) * batch, out);
+			}
+			end = timing_counter_get();
+
+			uint64_t lockstep = timing_cycles_get(&start, &end);
+
+			TC_PRINT("%2d channels, batch of %3u: per sample calls %u, "
+				 "block %u, lockstep %u cycles/sample\n",
+				 channels, batch, (unsigned int)(reference / samples),
+				 (unsigned int)(block / samples),
+				 (unsigned int)(lockstep / samples));
+		}
+	}
+
+	arm_biquad_casd_df1_inst_q31 iir_q31[SENSOR_CHANNELS];
+	arm_biquad_casd_df1_inst_q15 iir_q15[SENSOR_CHANNELS];
+	q31_t state_q31[SENSOR_CHANNELS][4 * PPG_IIR_NUMSTAGES];
+	q15_t state_q15[SENSOR_CHANNELS][4 * PPG_IIR_NUMSTAGES];
+
+	for (int ch = 0; ch < SENSOR_CHANNELS; ch++) {
+		ppg_filter_init_q31(&iir_q31[ch], state_q31[ch], table);
+		ppg_filter_init_q15(&iir_q15[ch], state_q15[ch], table);
+	}
+
+	for (size_t b = 0; b < ARRAY_SIZE(batches); b++) {
+		uint32_t batch = batches[b];
+		uint32_t slices = SIGNAL_LENGTH / batch;
+		uint32_t rounds = BENCH_ROUNDS * slices;
+		uint64_t samples = (uint64_t)rounds * batch;
+
+		start = timing_counter_get();
+		for (uint32_t i = 0; i < rounds; i++) {
+			q31_filter(iir_q31, batch, (i % slices) * batch);
+		}
+		end = timing_counter_get();
+
+		uint64_t q31 = timing_cycles_get(&start, &end);
+
+		start = timing_counter_get();
+		for (uint32_t i = 0; i < rounds; i++) {
+			q15_filter(iir_q15, batch, (i % slices) * batch);
+		}
+		end = timing_counter_get();
+
+		uint64_t q15 = timing_cycles_get(&start, &end);
+
+		TC_PRINT("%2d channels, batch of %3u: Q31 %u, Q15 %u cycles/sample\n",
+			 SENSOR_CHANNELS, batch, (unsigned int)(q31 / samples),
+			 (unsigned int)(q15 / samples));
+	}
+
+	timing_stop();
+}
+
+static void *ppg_filter_setup(void)
+{
+	/* The application's default, 100 Hz averaged by two */
+	table = ppg_filter_select(50.0f);
+
+	return NULL;
+}
+
+ZTEST_SUITE(ppg_filter, NULL, ppg_filter_setup, NULL, NULL, NULL);
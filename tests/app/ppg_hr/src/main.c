@@ -0,0 +1,197 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test ppg_hr streaming beat detection
+ *
+ * A synthetic PPG, pulses with a dicrotic wave dipping a large DC level, with
+ * breathing wander and noise, is fed one sample at a time the way the process
+ * thread does. Every beat must be found once, at the right interval, and the
+ * detector must follow changes of rate and amplitude, and find the beats again
+ * after a transient.
+ */
+
+#include <math.h>
+
+#include <zephyr/ztest.h>
+
+#include "ppg_hr.h"
+#include "ppg_sim.h"
+
+static struct ppg_hr hr;
+
+/* What the beats since the start of run() look like */
+static struct seen {
+	uint32_t intervals;
+	float min_interval_ms;
+	float max_interval_ms;
+	uint32_t last;        /* Sample index of the last beat */
+	uint32_t longest_gap; /* Samples between beats */
+	float bpm;
+} seen;
+
+static bool feed(void *ctx, float x[PPG_SIM_CHANNELS])
+{
+	struct ppg_hr_beat beat;
+
+	if (!ppg_hr_update(ctx, x[0], &beat)) {
+		return false;
+	}
+
+	seen.longest_gap = MAX(seen.longest_gap, beat.at - seen.last);
+	seen.last = beat.at;
+	if (beat.intervalMs > 0) {
+		seen.intervals++;
+		seen.min_interval_ms = MIN(seen.min_interval_ms, beat.intervalMs);
+		seen.max_interval_ms = MAX(seen.max_interval_ms, beat.intervalMs);
+	}
+	seen.bpm = beat.bpm;
+
+	return true;
+}
+
+/* Beats in the next 'seconds' */
+static uint32_t run(struct ppg_sim *s, double seconds)
+{
+	seen = (struct seen){ .min_interval_ms = 1e9f, .last = hr.n };
+	return ppg_sim_run(s, seconds, feed, &hr);
+}
+
+/* The pulse, with breathing and noise in proportion, dips 100000 counts */
+static void set_amplitude(struct ppg_sim *s, double amplitude)
+{
+	s->ac[0] = amplitude;
+	s->wander = 0.5 * amplitude;
+	s->noise = 0.02 * amplitude;
+}
+
+static struct ppg_sim sim(double fs, double bpm, double amplitude, uint32_t seed)
+{
+	struct ppg_sim s = { .fs = fs, .bpm = bpm, .dc = { 100000 }, .x = seed };
+
+	set_amplitude(&s, amplitude);
+	return s;
+}
+
+static void check_steady(double fs)
+{
+	struct ppg_sim s = sim(fs, 72, 2000, 1);
+
+	ppg_hr_reset(&hr, fs);
+	run(&s, 5);
+
+	uint32_t beats = run(&s, 60);
+
+	/* One beat per pulse, none doubled by the dicrotic wave */
+	zassert_within(beats, 72, 1, "%.0f Hz: %u beats in a minute", fs, beats);
+	zassert_true(seen.intervals >= 70, "%.0f Hz: %u intervals", fs, seen.intervals);
+	/* 833 ms, give or take the noise moving the peak a sample or two */
+	zassert_within(seen.min_interval_ms, 833, 40, "%.0f Hz: %.0f ms", fs,
+		       (double)seen.min_interval_ms);
+	zassert_within(seen.max_interval_ms, 833, 40, "%.0f Hz: %.0f ms", fs,
+		       (double)seen.max_interval_ms);
+	zassert_within(seen.bpm, 72, 1, "%.0f Hz: %.1f bpm", fs, (double)seen.bpm);
+}
+
+ZTEST(ppg_hr, test_steady_rate)
+{
+	check_steady(50);
+	check_steady(100);
+	check_steady(400);
+}
+
+ZTEST(ppg_hr, test_rate_change)
+{
+	struct ppg_sim s = sim(100, 60, 2000, 3);
+
+	ppg_hr_reset(&hr, s.fs);
+	run(&s, 30);
+	zassert_within(seen.bpm, 60, 1, "%.1f bpm", (double)seen.bpm);
+
+	/* Twice the rate at once, taken up after a few beats */
+	s.bpm = 120;
+	run(&s, 5);
+
+	uint32_t beats = run(&s, 10);
+
+	zassert_within(beats, 20, 1, "%u beats in 10 s", beats);
+	zassert_within(seen.bpm, 120, 2, "%.1f bpm", (double)seen.bpm);
+}
+
+ZTEST(ppg_hr, test_amplitude_change)
+{
+	struct ppg_sim s = sim(100, 80, 4000, 5);
+
+	ppg_hr_reset(&hr, s.fs);
+	run(&s, 20);
+
+	/* A quarter of the pulse, as after the finger moves */
+	set_amplitude(&s, 1000);
+	run(&s, 20);
+	zassert_true(seen.longest_gap < 5 * s.fs, "no beats for %u samples", seen.longest_gap);
+	zassert_within(seen.bpm, 80, 1, "%.1f bpm", (double)seen.bpm);
+
+	/* And back up, nothing lost */
+	set_amplitude(&s, 4000);
+
+	uint32_t beats = run(&s, 20);
+
+	zassert_within(beats, 27, 1, "%u beats in 20 s", beats);
+	zassert_within(seen.bpm, 80, 1, "%.1f bpm", (double)seen.bpm);
+}
+
+/*
+ * The level jumps by 'offset' for 'seconds', 0 for good. The beats come back
+ * within a few seconds, a step taking longer as the DC tracking follows it.
+ */
+static void check_transient(double offset, double seconds)
+{
+	struct ppg_sim s = sim(100, 72, 2000, 7);
+
+	ppg_hr_reset(&hr, s.fs);
+	run(&s, 30);
+	zassert_within(seen.bpm, 72, 1, "%.1f bpm", (double)seen.bpm);
+
+	s.offset = offset;
+	if (seconds > 0) {
+		run(&s, seconds);
+		s.offset = 0;
+	}
+
+	uint32_t beats = run(&s, 8);
+
+	zassert_true(beats >= 3, "%.0f for %.1f s: %u beats in 8 s after", offset, seconds,
+		     beats);
+
+	beats = run(&s, 20);
+	zassert_within(beats, 24, 1, "%.0f for %.1f s: %u beats in 20 s", offset, seconds,
+		       beats);
+	zassert_within(seen.bpm, 72, 1, "%.0f for %.1f s: %.1f bpm", offset, seconds,
+		       (double)seen.bpm);
+}
+
+ZTEST(ppg_hr, test_transient)
+{
+	/* A knock, then a step in the level as the sensor settles elsewhere */
+	check_transient(30000, 0.3);
+	check_transient(-30000, 0.3);
+	check_transient(30000, 0);
+	check_transient(-30000, 0);
+}
+
+ZTEST(ppg_hr, test_settle)
+{
+	struct ppg_hr_beat beat;
+
+	ppg_hr_reset(&hr, 100);
+
+	/* The filter's step up from rest after a reset is no beat */
+	for (int i = 0; i < 300; i++) {
+		float x = 100000.0f * (1.0f - expf(-i / 5.0f));
+
+		zassert_false(ppg_hr_update(&hr, x, &beat), "beat at %d", i);
+	}
+}
+
+ZTEST_SUITE(ppg_hr, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,263 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test PPG spectral heart rate
+ *
+ * This suite feeds a synthetic PPG, pulses with a dicrotic wave, to the
+ * spectral estimator one sample at a time, and checks that it finds the rate
+ * at different sample rates, through noise that hides the beats, and keeps
+ * to it while the rate drifts and a stronger motion artifact comes up nearby.
+ * The Goertzel bank must agree with the FFT, and find a stronger peak away
+ * from the one it tracks. It reports the cycles per update of both, and per
+ * sample of the push, to budget them against the acquisition.
+ */
+
+#include <math.h>
+
+#include <zephyr/ztest.h>
+#include <zephyr/timing/timing.h>
+
+#include "ppg_hr_fft.h"
+#include "ppg_sim.h"
+
+static struct ppg_hr_fft hr;
+static struct ppg_hr_fft goertzel;
+static float32_t scratch[PPG_HR_FFT_SCRATCH];
+
+/* A sine on top of the pulse, as walking gives */
+static struct {
+	float32_t amplitude;
+	float32_t bpm;
+	float32_t phase;
+} motion;
+
+/* Whether run() feeds the Goertzel estimator too, and the last results */
+static bool both;
+static struct ppg_hr_fft_result fft, bank;
+
+/* Returns whether the FFT estimator updated */
+static bool feed(void *ctx, float x[PPG_SIM_CHANNELS])
+{
+	const struct ppg_sim *s = ctx;
+	float32_t v = x[0] + motion.amplitude * sinf(2 * PI * motion.phase);
+	bool updated = false;
+
+	motion.phase += motion.bpm / 60.0f / (float32_t)s->fs;
+
+	if (ppg_hr_fft_push(&hr, v)) {
+		ppg_hr_fft_update(&hr, scratch, &fft);
+		updated = true;
+	}
+	if (both && ppg_hr_fft_push(&goertzel, v)) {
+		ppg_hr_fft_update_goertzel(&goertzel, scratch, &bank);
+	}
+
+	return updated;
+}
+
+/* FFT updates in the next 'seconds', the Goertzel estimator fed only if 'with_bank' */
+static uint32_t run(struct ppg_sim *s, float32_t seconds, bool with_bank)
+{
+	both = with_bank;
+	return ppg_sim_run(s, seconds, feed, s);
+}
+
+/* A pulse of 'amplitude' dipping 100000 counts, with uniform noise */
+static struct ppg_sim sim(double fs, double bpm, double amplitude, double noise, uint32_t seed)
+{
+	struct ppg_sim s = {
+		.fs = fs, .bpm = bpm, .dc = { 100000 }, .ac = { amplitude }, .noise = noise,
+		.x = seed
+	};
+
+	motion.amplitude = 0;
+	motion.phase = 0;
+	return s;
+}
+
+static void check_rate(float32_t fs, float32_t bpm)
+{
+	struct ppg_sim s = sim(fs, bpm, 2000, 20, 1);
+
+	zassert_equal(ppg_hr_fft_init(&hr, fs), ARM_MATH_SUCCESS);
+	zassert_equal(ppg_hr_fft_init(&goertzel, fs), ARM_MATH_SUCCESS);
+
+	/* Nothing until the window, about 8 s, is full, then one update a second */
+	float32_t window = PPG_HR_FFT_WINDOW / hr.rate;
+
+	zassert_within(window, 8.0f, 0.5f, "%.0f Hz: %.2f s window", (double)fs, (double)window);
+	zassert_equal(run(&s, window - 0.1f, false), 0);
+	ppg_hr_fft_init(&hr, fs);
+	s.phase = 0;
+	uint32_t analysed = (uint32_t)((window + 12.0f) * fs) / hr.decimate;
+	uint32_t updates = run(&s, window + 12.0f, true);
+
+	zassert_equal(updates, 1 + (analysed - PPG_HR_FFT_WINDOW) / hr.hop, "%.0f Hz: %u updates",
+		      (double)fs, updates);
+	zassert_within(hr.hop / hr.rate, 1.0f, 0.05f);
+
+	zassert_within(fft.bpm, bpm, 1.0f, "%.0f Hz: %.1f bpm, expected %.0f", (double)fs,
+		       (double)fft.bpm, (double)bpm);
+	zassert_true(fft.confidence > 0.3f, "confidence %.2f", (double)fft.confidence);
+	zassert_within(bank.bpm, bpm, 1.0f, "Goertzel %.0f Hz: %.1f bpm", (double)fs,
+		       (double)bank.bpm);
+}
+
+ZTEST(ppg_hr_fft, test_rates)
+{
+	check_rate(50, 72);
+	check_rate(62.5f, 45);
+	check_rate(100, 130);
+	check_rate(400, 180);
+}
+
+ZTEST(ppg_hr_fft, test_goertzel_matches_fft)
+{
+	struct ppg_sim s = sim(100, 66, 2000, 500, 7);
+
+	ppg_hr_fft_init(&hr, s.fs);
+	ppg_hr_fft_init(&goertzel, s.fs);
+
+	/* Same samples, same bins, so the same peak whether locked or not */
+	for (int i = 0; i < 5; i++) {
+		run(&s, i == 0 ? 8 : 1, true);
+		zassert_within(bank.bpm, fft.bpm, 0.05f, "%.2f and %.2f bpm", (double)bank.bpm,
+			       (double)fft.bpm);
+		zassert_within(bank.confidence, fft.confidence, 0.01f);
+	}
+	zassert_true(bank.bins < fft.bins, "Goertzel evaluated %u bins", bank.bins);
+}
+
+ZTEST(ppg_hr_fft, test_noise)
+{
+	/* Noise as big as the pulse, no beat stands out on its own */
+	struct ppg_sim s = sim(100, 84, 1000, 1000, 3);
+
+	ppg_hr_fft_init(&hr, s.fs);
+	run(&s, 30, false);
+
+	zassert_within(fft.bpm, 84, 2.0f, "%.1f bpm", (double)fft.bpm);
+
+	/* Noise alone is no heart rate */
+	s.ac[0] = 0;
+	run(&s, 10, false);
+
+	zassert_equal(fft.bpm, 0.0f, "%.1f bpm, confidence %.2f", (double)fft.bpm,
+		      (double)fft.confidence);
+}
+
+ZTEST(ppg_hr_fft, test_tracking)
+{
+	struct ppg_sim s = sim(50, 70, 2000, 200, 5);
+
+	ppg_hr_fft_init(&hr, s.fs);
+	ppg_hr_fft_init(&goertzel, s.fs);
+	run(&s, 10, true);
+	zassert_within(fft.bpm, 70, 1.0f, "%.1f bpm", (double)fft.bpm);
+
+	/*
+	 * Walking starts: a motion artifact stronger than the pulse's
+	 * fundamental (about 500 counts), while the rate rises a beat a minute
+	 * each second. Both keep to the pulse, at the rate of the middle of the
+	 * window, 4 s back.
+	 */
+	motion.amplitude = 600;
+	motion.bpm = 110;
+	for (int i = 0; i < 20; i++) {
+		s.bpm += 1.0;
+		run(&s, 1, true);
+
+		float32_t expected = MAX(70.0f, (float32_t)s.bpm - 4.0f);
+
+		zassert_within(fft.bpm, expected, 2.0f, "%.1f bpm, expected %.0f",
+			       (double)fft.bpm, (double)expected);
+		zassert_within(bank.bpm, expected, 2.0f, "Goertzel %.1f bpm, expected %.0f",
+			       (double)bank.bpm, (double)expected);
+	}
+
+	/* Starting from nothing, the artifact is the strongest peak */
+	ppg_hr_fft_init(&hr, s.fs);
+	run(&s, 9, false);
+	zassert_within(fft.bpm, 110, 3.0f, "%.1f bpm", (double)fft.bpm);
+}
+
+ZTEST(ppg_hr_fft, test_reacquire)
+{
+	struct ppg_sim s = sim(50, 70, 2000, 20, 9);
+
+	ppg_hr_fft_init(&hr, s.fs);
+	ppg_hr_fft_init(&goertzel, s.fs);
+	run(&s, 10, true);
+	zassert_within(bank.bpm, 70, 1.0f, "%.1f bpm", (double)bank.bpm);
+
+	/*
+	 * An artifact far out of the tracked bins and much stronger than the
+	 * pulse, which still holds enough of the energy to stay confident. Once
+	 * the FFT has moved to it, the bank follows at its next look at the
+	 * whole band.
+	 */
+	motion.amplitude = 800;
+	motion.bpm = 130;
+	run(&s, 8, true);
+	zassert_within(fft.bpm, 130, 3.0f, "%.1f bpm", (double)fft.bpm);
+	run(&s, PPG_HR_FFT_FULL_EVERY, true);
+	zassert_within(bank.bpm, fft.bpm, 0.05f, "Goertzel %.1f bpm, FFT %.1f", (double)bank.bpm,
+		       (double)fft.bpm);
+}
+
+ZTEST(ppg_hr_fft, test_benchmark)
+{
+	struct ppg_sim s = sim(100, 72, 2000, 20, 1);
+	struct ppg_hr_fft_result result;
+	timing_t start, end;
+
+	ppg_hr_fft_init(&hr, s.fs);
+	timing_init();
+	timing_start();
+
+	/* The push, per input sample, over a window's worth */
+	uint32_t samples = PPG_HR_FFT_WINDOW * hr.decimate;
+	uint64_t push = 0;
+
+	for (uint32_t i = 0; i < samples; i++) {
+		float x[PPG_SIM_CHANNELS];
+
+		ppg_sim_sample(&s, x);
+		start = timing_counter_get();
+		ppg_hr_fft_push(&hr, x[0]);
+		end = timing_counter_get();
+		push += timing_cycles_get(&start, &end);
+	}
+
+	start = timing_counter_get();
+	ppg_hr_fft_update(&hr, scratch, &result);
+	end = timing_counter_get();
+
+	uint64_t update = timing_cycles_get(&start, &end);
+
+	/* Unlocked the bank covers the band, locked only the tracked bins */
+	hr.bpm = 0;
+	start = timing_counter_get();
+	ppg_hr_fft_update_goertzel(&hr, scratch, &result);
+	end = timing_counter_get();
+
+	uint64_t band = timing_cycles_get(&start, &end);
+	uint16_t bandBins = result.bins;
+
+	start = timing_counter_get();
+	ppg_hr_fft_update_goertzel(&hr, scratch, &result);
+	end = timing_counter_get();
+
+	uint64_t locked = timing_cycles_get(&start, &end);
+
+	TC_PRINT("push %u cycles/sample, update: FFT %u, Goertzel %u (%u bins), "
+		 "locked %u (%u bins) cycles\n",
+		 (unsigned int)(push / samples), (unsigned int)update, (unsigned int)band,
+		 bandBins, (unsigned int)locked, result.bins);
+
+	timing_stop();
+}
+
+ZTEST_SUITE(ppg_hr_fft, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,231 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test ppg_motion accelerometer referenced artifact cancellation
+ *
+ * A synthetic PPG, pulses on a large DC level in three channels, gets a
+ * walking artifact added that is a short filter of the synthetic
+ * acceleration, different for each channel. Fed one sample at a time with
+ * the acceleration, as the process thread does, the canceller must take most
+ * of the artifact out, leave the signal alone at rest, and let the beat
+ * detector find the pulse again. The accelerometer ring must give the
+ * acceleration in between its samples, across a timestamp wrap.
+ */
+
+#include <math.h>
+
+#include <zephyr/ztest.h>
+
+#include "ppg_hr.h"
+#include "ppg_motion.h"
+#include "ppg_sim.h"
+
+#define MU 0.02f
+
+static struct ppg_motion m;
+static struct ppg_hr hr;
+static bool with_hr;
+
+/* Walking, feed() turns it into acceleration and an artifact on the PPG */
+static struct walk {
+	double step_hz;    /* Cadence, 0 at rest */
+	double step_phase; /* Steps since the start */
+	/* Last few samples of the dynamic acceleration, newest first */
+	double motion[3][4];
+} walk;
+
+/* Since the start of run() */
+static struct seen {
+	double before[3]; /* Squared error against the clean signal, counts */
+	double after[3];
+	float bpm;        /* Of the last beat on the cleaned IR */
+} seen;
+
+/* Pulse and DC level of each channel, ADC counts */
+static const double pulse_ac[3] = { 1000, 2000, 1500 };
+static const double dc[3] = { 100000, 120000, 80000 };
+
+/* Counts per m/s^2 of each axis in each channel, for the newest sample and
+ * the two before: the artifact lags the movement a little
+ */
+static const double gain[3][3][3] = {
+	{ { 200, 400, 200 }, { 100, 0, 0 }, { 0, 600, 400 } },
+	{ { 0, 300, 300 }, { 0, 0, 200 }, { 1000, 600, 0 } },
+	{ { 400, 0, 0 }, { 200, 200, 0 }, { 0, 800, 1000 } },
+};
+
+/*
+ * Adds the artifact to the clean sample x[], cancels it with the accelerometer
+ * reading, gravity on z plus sensor noise, and feeds the IR to the beat
+ * detector if with_hr
+ */
+static bool feed(void *ctx, float x[PPG_SIM_CHANNELS])
+{
+	struct ppg_sim *s = ctx;
+	double w = 2 * PPG_SIM_PI * walk.step_phase;
+	double now[3] = {
+		0.8 * sin(w / 2),                 /* Arm swing, every other step */
+		0.5 * sin(w + 0.7),
+		2.0 * sin(w) + 0.6 * sin(2 * w),  /* Bounce */
+	};
+	float clean[3], acc[3];
+	struct ppg_hr_beat beat;
+
+	for (int a = 0; a < 3; a++) {
+		for (int k = 3; k > 0; k--) {
+			walk.motion[a][k] = walk.motion[a][k - 1];
+		}
+		walk.motion[a][0] = walk.step_hz > 0 ? now[a] : 0.0;
+		acc[a] = (float)(walk.motion[a][0] + (a == 2 ? 9.81 : 0.0) + 0.01 * ppg_sim_noise(s));
+	}
+	walk.step_phase += walk.step_hz / s->fs;
+
+	for (int c = 0; c < 3; c++) {
+		double artifact = 0;
+
+		for (int a = 0; a < 3; a++) {
+			for (int k = 0; k < 3; k++) {
+				artifact += gain[c][a][k] * walk.motion[a][k];
+			}
+		}
+		clean[c] = x[c];
+		x[c] = (float)(clean[c] + artifact);
+		seen.before[c] += (x[c] - clean[c]) * (x[c] - clean[c]);
+	}
+
+	ppg_motion_update(&m, acc, x);
+
+	for (int c = 0; c < 3; c++) {
+		seen.after[c] += (x[c] - clean[c]) * (x[c] - clean[c]);
+	}
+	if (with_hr && ppg_hr_update(&hr, x[1], &beat) && beat.bpm > 0) {
+		seen.bpm = beat.bpm;
+	}
+
+	return false;
+}
+
+/* Leaves the RMS errors in seen */
+static void run(struct ppg_sim *s, double seconds)
+{
+	uint32_t count = (uint32_t)(seconds * s->fs);
+
+	seen = (struct seen){ 0 };
+	ppg_sim_run(s, seconds, feed, s);
+
+	for (int c = 0; c < 3; c++) {
+		seen.before[c] = sqrt(seen.before[c] / count);
+		seen.after[c] = sqrt(seen.after[c] / count);
+	}
+}
+
+/* The three channels, walking at 'step_hz' */
+static struct ppg_sim start(double fs, double bpm, double step_hz, uint32_t seed)
+{
+	struct ppg_sim s = {
+		.fs = fs, .bpm = bpm, .dc = { dc[0], dc[1], dc[2] },
+		.ac = { pulse_ac[0], pulse_ac[1], pulse_ac[2] }, .x = seed
+	};
+
+	walk = (struct walk){ .step_hz = step_hz };
+	with_hr = false;
+	ppg_motion_reset(&m, fs, MU);
+
+	return s;
+}
+
+static void check_walking(double fs)
+{
+	struct ppg_sim s = start(fs, 75, 1.8, 1);
+
+	run(&s, 10);
+	run(&s, 10);
+
+	/*
+	 * The artifact, bigger than the pulse, down by 20 dB or more. The pulse
+	 * is noise to the adaptation, what is left is mostly the weights
+	 * wandering with it.
+	 */
+	for (int c = 0; c < 3; c++) {
+		zassert_true(seen.before[c] > pulse_ac[c], "%.0f Hz: artifact %.0f", fs,
+			     seen.before[c]);
+		zassert_true(seen.after[c] < 0.1 * seen.before[c],
+			     "%.0f Hz channel %d: %.0f left of %.0f", fs, c, seen.after[c],
+			     seen.before[c]);
+	}
+}
+
+ZTEST(ppg_motion, test_walking)
+{
+	check_walking(50);
+	check_walking(100);
+}
+
+ZTEST(ppg_motion, test_rest)
+{
+	struct ppg_sim s = start(100, 60, 0, 3);
+
+	run(&s, 30);
+
+	/* Sensor noise only in the reference, the pulse goes through */
+	for (int c = 0; c < 3; c++) {
+		zassert_true(seen.after[c] < 0.01 * pulse_ac[c], "channel %d changed by %.1f", c,
+			     seen.after[c]);
+	}
+}
+
+ZTEST(ppg_motion, test_heart_rate)
+{
+	struct ppg_sim s = start(100, 66, 1.8, 5);
+
+	ppg_hr_reset(&hr, s.fs);
+	with_hr = true;
+
+	/* Walking from the start, the beats come through once it has learnt */
+	run(&s, 10);
+	run(&s, 10);
+	zassert_within(seen.bpm, 66, 2, "%.1f bpm", (double)seen.bpm);
+}
+
+ZTEST(ppg_motion, test_ring)
+{
+	static struct ppg_motion_ring ring;
+	float acc[3];
+
+	ppg_motion_ring_reset(&ring);
+	zassert_false(ppg_motion_ring_at(&ring, 0, acc));
+
+	/* 50 Hz, a ramp on each axis, timestamps wrapping half way */
+	uint32_t t0 = UINT32_MAX - 64 * 20000;
+
+	for (uint32_t k = 0; k < 2 * PPG_MOTION_RING; k++) {
+		float v[3] = { (float)k, -(float)k, 1000.0f + k };
+
+		ppg_motion_ring_push(&ring, t0 + k * 20000, v);
+	}
+
+	/* The ring holds the last PPG_MOTION_RING samples */
+	uint32_t first = PPG_MOTION_RING;
+	uint32_t last = 2 * PPG_MOTION_RING - 1;
+
+	zassert_false(ppg_motion_ring_at(&ring, t0 + first * 20000 - 1, acc));
+	zassert_true(ppg_motion_ring_at(&ring, t0 + first * 20000, acc));
+	zassert_within(acc[0], first, 1e-3f);
+
+	/* In between, both sides of the wrap */
+	for (uint32_t k = first; k < last; k += 7) {
+		zassert_true(ppg_motion_ring_at(&ring, t0 + k * 20000 + 5000, acc));
+		zassert_within(acc[0], k + 0.25f, 1e-3f, "%f at %u", (double)acc[0], k);
+		zassert_within(acc[1], -(k + 0.25f), 1e-3f);
+		zassert_within(acc[2], 1000.25f + k, 1e-2f);
+	}
+
+	/* Up to a period past the newest it holds, further is too new */
+	zassert_true(ppg_motion_ring_at(&ring, t0 + last * 20000 + 20000, acc));
+	zassert_within(acc[0], last, 1e-3f);
+	zassert_false(ppg_motion_ring_at(&ring, t0 + last * 20000 + 20001, acc));
+}
+
+ZTEST_SUITE(ppg_motion, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,115 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test ppg_spo2 ratio of ratios SpO2 and perfusion index
+ *
+ * Red and IR pulses of known amplitudes on known DC levels are fed one sample
+ * at a time, with the beats from the heart rate detector on IR, as the process
+ * thread does. The reports must come once a second with the ratio, perfusion
+ * index and saturation the amplitudes give.
+ */
+
+#include <zephyr/ztest.h>
+
+#include "ppg_hr.h"
+#include "ppg_sim.h"
+#include "ppg_spo2.h"
+
+#define FS 100
+#define RED_DC 100000.0
+#define IR_DC 120000.0
+
+static const struct ppg_spo2_cal cal = {PPG_SPO2_CAL_A, PPG_SPO2_CAL_B, PPG_SPO2_CAL_C};
+
+static struct ppg_hr hr;
+static struct ppg_spo2 spo2;
+
+/* The reports since the start of run() */
+static struct seen {
+	struct ppg_spo2_report last;
+	uint16_t min_beats;
+} seen;
+
+/* Red in channel 0, IR in 1, the beats from IR */
+static bool feed(void *ctx, float x[PPG_SIM_CHANNELS])
+{
+	struct ppg_hr_beat beat;
+	struct ppg_spo2_report report;
+	bool is_beat = ppg_hr_update(&hr, x[1], &beat);
+
+	if (!ppg_spo2_update(ctx, x[0], x[1], is_beat, &report)) {
+		return false;
+	}
+
+	seen.last = report;
+	seen.min_beats = MIN(seen.min_beats, report.beats);
+
+	return true;
+}
+
+/* Reports in the next 'seconds' */
+static uint32_t run(struct ppg_sim *s, double seconds)
+{
+	seen.min_beats = UINT16_MAX;
+	return ppg_sim_run(s, seconds, feed, &spo2);
+}
+
+/* Red and IR pulses of the given height, 5 s in */
+static struct ppg_sim start(double bpm, double red_ac, double ir_ac)
+{
+	struct ppg_sim s = {
+		.fs = FS, .bpm = bpm, .dc = { RED_DC, IR_DC }, .ac = { red_ac, ir_ac }
+	};
+
+	ppg_hr_reset(&hr, FS);
+	ppg_spo2_reset(&spo2, FS, &cal);
+	run(&s, 5);
+
+	return s;
+}
+
+ZTEST(ppg_spo2, test_normal_saturation)
+{
+	struct ppg_sim s = start(75, 1000, 2400);
+	uint32_t reports = run(&s, 10);
+
+	/* R = (1000 / 100000) / (2400 / 120000) = 0.5 */
+	zassert_equal(reports, 10, "%u reports in 10 s", reports);
+	zassert_true(seen.min_beats >= 1, "a second without beats");
+	zassert_within(seen.last.ratio, 0.5f, 0.005f, "R %f", (double)seen.last.ratio);
+	zassert_within(seen.last.perfusion, 2.0f, 0.02f, "PI %f", (double)seen.last.perfusion);
+	zassert_within(seen.last.spo2, 98.76f, 0.3f, "SpO2 %f", (double)seen.last.spo2);
+}
+
+ZTEST(ppg_spo2, test_low_saturation)
+{
+	struct ppg_sim s = start(90, 1000, 1200);
+
+	run(&s, 10);
+
+	/* R = 1, SpO2 = a + b + c */
+	zassert_within(seen.last.ratio, 1.0f, 0.01f, "R %f", (double)seen.last.ratio);
+	zassert_within(seen.last.perfusion, 1.0f, 0.01f, "PI %f", (double)seen.last.perfusion);
+	zassert_within(seen.last.spo2, 80.14f, 0.5f, "SpO2 %f", (double)seen.last.spo2);
+}
+
+ZTEST(ppg_spo2, test_hold)
+{
+	struct ppg_sim s = start(40, 1000, 2400);
+
+	/* A beat every 1.5 s, the seconds without one repeat the reading */
+	zassert_equal(run(&s, 10), 10);
+	zassert_equal(seen.min_beats, 0);
+	zassert_within(seen.last.spo2, 98.76f, 0.3f, "SpO2 %f", (double)seen.last.spo2);
+
+	/* No pulse at all, the reading goes after PPG_SPO2_HOLD seconds */
+	s.ac[0] = 0;
+	s.ac[1] = 0;
+	run(&s, PPG_SPO2_HOLD + 2);
+	zassert_equal(seen.last.beats, 0);
+	zassert_equal(seen.last.spo2, 0.0f, "SpO2 %f", (double)seen.last.spo2);
+}
+
+ZTEST_SUITE(ppg_spo2, NULL, NULL, NULL, NULL, NULL);
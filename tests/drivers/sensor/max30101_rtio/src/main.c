@@ -0,0 +1,236 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test maxim,max30101-rtio driver against the register level emulator
+ *
+ * Runs the asynchronous sensor API driver on native_sim, with the sensor
+ * emulated on i2c0 and its INT line on gpio0. Covers sample_fetch(), one
+ * shot sensor_read() and watermark streaming, which only keeps going if the
+ * driver acknowledges A_FULL, and checks the decoded q31 values and their
+ * timestamps against the waveform.
+ */
+
+#include <zephyr/ztest.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/rtio/rtio.h>
+
+#include <app/drivers/max30101_emul.h>
+
+#define PPG_NODE DT_NODELABEL(ppg)
+
+/* 400 Hz */
+#define PERIOD_NS 2500000
+#define WATERMARK DT_PROP(PPG_NODE, fifo_watermark)
+/* 18 bit counts as q31 */
+#define Q31_SHIFT 18
+
+static const struct device *ppg_dev = DEVICE_DT_GET(PPG_NODE);
+static const struct i2c_dt_spec ppg_i2c = I2C_DT_SPEC_GET(PPG_NODE);
+static const struct emul *ppg_emul = EMUL_DT_GET(PPG_NODE);
+
+SENSOR_DT_READ_IODEV(ppg_read, PPG_NODE, {SENSOR_CHAN_RED, 0},
+		     {SENSOR_CHAN_IR, 0});
+RTIO_DEFINE(ppg_read_ctx, 1, 1);
+
+SENSOR_DT_STREAM_IODEV(ppg_stream, PPG_NODE,
+		       {SENSOR_TRIG_FIFO_WATERMARK, SENSOR_STREAM_DATA_INCLUDE});
+RTIO_DEFINE_WITH_MEMPOOL(ppg_stream_ctx, 4, 4, 4, 256, sizeof(void *));
+
+/* Red, IR and green step by one per record */
+static uint32_t ramp[1024][3];
+
+/* Room for a full FIFO of one channel */
+static uint8_t decoded[sizeof(struct sensor_q31_data) +
+		       32 * sizeof(struct sensor_q31_sample_data)] __aligned(8);
+
+static uint64_t now_ns(void)
+{
+	return k_ticks_to_ns_floor64(k_uptime_ticks());
+}
+
+/* Decode every frame of one channel, returns the count */
+static uint16_t decode(const uint8_t *buf, enum sensor_channel chan)
+{
+	const struct sensor_decoder_api *decoder;
+	struct sensor_chan_spec spec = {chan, 0};
+	uint16_t frames;
+	uint32_t fit = 0;
+
+	zassert_ok(sensor_get_decoder(ppg_dev, &decoder));
+	zassert_ok(decoder->get_frame_count(buf, spec, &frames));
+	zassert_true(frames <= 32);
+	zassert_equal(decoder->decode(buf, spec, &fit, 32, decoded), frames);
+	zassert_equal(fit, frames);
+
+	return frames;
+}
+
+/*
+ * The decoded frames are consecutive waveform entries of the channel, evenly
+ * spaced, as 18 bit counts. Returns the newest count.
+ */
+static uint32_t check_frames(uint16_t frames, uint32_t offset)
+{
+	const struct sensor_q31_data *out = (const void *)decoded;
+	uint32_t first = out->readings[0].value >> (31 - Q31_SHIFT);
+
+	zassert_equal(out->shift, Q31_SHIFT);
+	zassert_equal(out->header.reading_count, frames);
+	zassert_between_inclusive(first, offset, offset + ARRAY_SIZE(ramp));
+
+	for (uint16_t i = 0; i < frames; i++) {
+		zassert_equal(out->readings[i].value, (first + i) << (31 - Q31_SHIFT),
+			      "frame %u", i);
+		zassert_equal(out->readings[i].timestamp_delta, i * PERIOD_NS);
+	}
+
+	return first + frames - 1;
+}
+
+static void *max30101_rtio_setup(void)
+{
+	for (uint32_t i = 0; i < ARRAY_SIZE(ramp); i++) {
+		ramp[i][0] = 100000 + i;
+		ramp[i][1] = 110000 + i;
+		ramp[i][2] = 120000 + i;
+	}
+
+	zassert_true(device_is_ready(ppg_dev));
+
+	return NULL;
+}
+
+static void max30101_rtio_before(void *fixture)
+{
+	const uint8_t clear[] = {0x04, 0, 0, 0}; /* FIFO_WR, OVF and FIFO_RD */
+
+	max30101_emul_set_waveform(ppg_emul, ramp, ARRAY_SIZE(ramp));
+	zassert_ok(i2c_write_dt(&ppg_i2c, clear, sizeof(clear)));
+}
+
+ZTEST(max30101_rtio, test_fetch)
+{
+	struct sensor_value red, ir, green;
+
+	k_msleep(10);
+	zassert_ok(sensor_sample_fetch(ppg_dev));
+	zassert_ok(sensor_channel_get(ppg_dev, SENSOR_CHAN_RED, &red));
+	zassert_ok(sensor_channel_get(ppg_dev, SENSOR_CHAN_IR, &ir));
+	zassert_equal(sensor_channel_get(ppg_dev, SENSOR_CHAN_GREEN, &green),
+		      -ENOTSUP, "green is not in a slot");
+
+	zassert_between_inclusive(red.val1, 100000, 100000 + ARRAY_SIZE(ramp));
+	zassert_equal(ir.val1, red.val1 + 10000);
+
+	/* The newest record every time, 4 records at 400 Hz later */
+	int32_t before = red.val1;
+
+	k_msleep(10);
+	zassert_ok(sensor_sample_fetch(ppg_dev));
+	zassert_ok(sensor_channel_get(ppg_dev, SENSOR_CHAN_RED, &red));
+	zassert_within(red.val1 - before, 4, 1, "%d records in 10 ms",
+		       red.val1 - before);
+}
+
+ZTEST(max30101_rtio, test_read)
+{
+	const struct sensor_decoder_api *decoder;
+	uint8_t buf[256];
+
+	k_msleep(25);
+
+	uint64_t start = now_ns();
+
+	zassert_ok(sensor_read(&ppg_read, &ppg_read_ctx, buf, sizeof(buf)));
+
+	uint64_t end = now_ns();
+
+	/* 10 records in 25 ms, give or take the one in conversion */
+	uint16_t frames = decode(buf, SENSOR_CHAN_RED);
+
+	zassert_within(frames, 10, 1, "%u records in 25 ms", frames);
+
+	uint32_t red = check_frames(frames, 100000);
+
+	/* The newest record is stamped with the time of the read */
+	const struct sensor_q31_data *out = (const void *)decoded;
+	uint64_t newest = out->header.base_timestamp_ns +
+			  out->readings[frames - 1].timestamp_delta;
+
+	zassert_between_inclusive(newest, start, end);
+
+	/* IR comes first in the FIFO records, the decoder sorts that out */
+	zassert_equal(decode(buf, SENSOR_CHAN_IR), frames);
+	zassert_equal(check_frames(frames, 110000), red + 10000);
+
+	zassert_ok(sensor_get_decoder(ppg_dev, &decoder));
+	zassert_false(decoder->has_trigger(buf, SENSOR_TRIG_FIFO_WATERMARK));
+}
+
+ZTEST(max30101_rtio, test_stream)
+{
+	struct rtio_sqe *handle;
+	const struct sensor_decoder_api *decoder;
+	uint32_t written, lost, lost_before;
+	uint64_t next_base = 0;
+	uint32_t next_red = 0;
+
+	zassert_ok(sensor_get_decoder(ppg_dev, &decoder));
+	max30101_emul_get_counts(ppg_emul, &written, &lost_before);
+	zassert_ok(sensor_stream(&ppg_stream, &ppg_stream_ctx, NULL, &handle));
+
+	/*
+	 * A_FULL only fires again once the driver has read INT_STS1, so the
+	 * batches after the first one test the acknowledge
+	 */
+	for (int batch = 0; batch < 3; batch++) {
+		int64_t start = k_uptime_get();
+		struct rtio_cqe *cqe = rtio_cqe_consume_block(&ppg_stream_ctx);
+		int64_t elapsed = k_uptime_get() - start;
+		uint8_t *buf;
+		uint32_t buf_len;
+
+		zassert_ok(cqe->result, "batch %d", batch);
+		zassert_ok(rtio_cqe_get_mempool_buffer(&ppg_stream_ctx, cqe, &buf,
+						       &buf_len));
+		rtio_cqe_release(&ppg_stream_ctx, cqe);
+
+		/* 24 records at 400 Hz, from empty */
+		zassert_within(elapsed, WATERMARK * PERIOD_NS / 1000000, 10,
+			       "batch %d after %lld ms", batch, elapsed);
+		zassert_true(decoder->has_trigger(buf, SENSOR_TRIG_FIFO_WATERMARK));
+		zassert_false(decoder->has_trigger(buf, SENSOR_TRIG_FIFO_FULL));
+
+		uint16_t frames = decode(buf, SENSOR_CHAN_RED);
+		const struct sensor_q31_data *out = (const void *)decoded;
+		uint32_t first = out->readings[0].value >> (31 - Q31_SHIFT);
+
+		zassert_within(frames, WATERMARK, 1, "batch %d: %u records",
+			       batch, frames);
+
+		/* Each batch carries on where the last one stopped */
+		if (batch > 0) {
+			zassert_equal(first, next_red, "batch %d", batch);
+			zassert_within(out->header.base_timestamp_ns, next_base,
+				       PERIOD_NS, "batch %d", batch);
+		}
+		next_red = check_frames(frames, 100000) + 1;
+		next_base = out->header.base_timestamp_ns +
+			    (uint64_t)frames * PERIOD_NS;
+
+		rtio_release_buffer(&ppg_stream_ctx, buf, buf_len);
+	}
+
+	rtio_sqe_cancel(handle);
+
+	/* Nothing overflowed while streaming */
+	max30101_emul_get_counts(ppg_emul, &written, &lost);
+	zassert_equal(lost, lost_before, "%u records lost", lost - lost_before);
+}
+
+ZTEST_SUITE(max30101_rtio, NULL, max30101_rtio_setup, max30101_rtio_before,
+	    NULL, NULL);